@@ -0,0 +1,113 @@
+/*
+ * File: BufferPool.cpp
+ *
+ * Reference counted buffer pool for the reliable data transport (RDT) library.
+ *
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "BufferPool.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the BufferPool header file.
+ */
+
+BufferPool::BufferPool() {
+	this->buffer_size 	= 0;
+	this->stride 		= CACHE_LINE_SIZE;
+	this->slab_buffers 	= 1;
+	this->free_head 	= -1;
+	this->allocations 	= 0;
+}
+
+BufferPool::~BufferPool() {
+	this->reset(0);
+}
+
+void BufferPool::reset(int buffer_size) {
+	for (size_t i = 0; i < this->slabs.size(); i++) {
+		free(this->slabs[i]);
+	}
+	this->slabs.clear();
+	this->ref_counts.clear();
+	this->free_head = -1;
+
+	// Every buffer is at least a cache line, which leaves room for the free
+	// list's link
+	this->buffer_size 	= buffer_size;
+	this->stride 		= (buffer_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	if (this->stride < CACHE_LINE_SIZE) {
+		this->stride = CACHE_LINE_SIZE;
+	}
+	this->slab_buffers = SLAB_SIZE / this->stride;
+	if (this->slab_buffers < 1) {
+		this->slab_buffers = 1;
+	}
+}
+
+void BufferPool::add_slab() {
+	void *slab;
+	int error = posix_memalign(&slab, CACHE_LINE_SIZE, (size_t)this->stride * this->slab_buffers);
+	if (error != 0) {
+		errno = error;
+		perror("BufferPool posix_memalign");
+		exit(EXIT_FAILURE);
+	}
+	this->allocations++;
+
+	// The bookkeeping grows with it (now and then)
+	size_t slabs_capacity 	= this->slabs.capacity();
+	size_t counts_capacity 	= this->ref_counts.capacity();
+	int first 				= this->ref_counts.size();
+	this->slabs.push_back((char*)slab);
+	this->ref_counts.resize(first + this->slab_buffers, 0);
+	this->allocations += (this->slabs.capacity() != slabs_capacity)
+						 + (this->ref_counts.capacity() != counts_capacity);
+
+	// Chain the new buffers in order, ahead of whatever was free already
+	for (int id = first + this->slab_buffers - 1; id >= first; id--) {
+		memcpy(this->get(id), &this->free_head, sizeof(int));
+		this->free_head = id;
+	}
+}
+
+int BufferPool::acquire() {
+	if (this->free_head < 0) {
+		this->add_slab();
+	}
+
+	int id = this->free_head;
+	memcpy(&this->free_head, this->get(id), sizeof(int));
+	this->ref_counts[id] = 1;
+	return id;
+}
+
+void BufferPool::retain(int id) {
+	this->ref_counts[id]++;
+}
+
+void BufferPool::release(int id) {
+	if (--this->ref_counts[id] == 0) {
+		memcpy(this->get(id), &this->free_head, sizeof(int));
+		this->free_head = id;
+	}
+}
+
+int BufferPool::ref_count(int id) {
+	return this->ref_counts[id];
+}
+
+char *BufferPool::get(int id) {
+	return this->slabs[id / this->slab_buffers] 
+			+ (size_t)(id % this->slab_buffers) * this->stride;
+}
+
+uint64_t BufferPool::get_allocations() {
+	return this->allocations;
+}
@@ -0,0 +1,106 @@
+/*
+ * File: BufferPool.h
+ *
+ * Header / API file for a pool of fixed size, reference counted buffers used
+ * by the RDT library to receive segments into, and to keep copies of the
+ * segments it sends. A buffer is only reused once everyone holding it (the
+ * I/O layer, the reassembly buffer, the retransmission queue, or an
+ * application that was lent a segment) has released it.
+ *
+ * Buffers are carved out of slabs of about SLAB_SIZE bytes, each one starting
+ * on a cache line. Free buffers are chained through their own first bytes, so
+ * taking one out of the pool or putting it back never touches the heap: the
+ * pool only allocates when every buffer it has is in use, and never frees
+ * anything until it is reset.
+ *
+ */
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstdint>
+#include <vector>
+
+class BufferPool {
+public:
+	// Buffers start on (and are padded to) a multiple of this
+	static const int CACHE_LINE_SIZE = 64;
+
+	// Bytes allocated at a time (a slab holds at least one buffer)
+	static const int SLAB_SIZE = 256 * 1024;
+
+	BufferPool();
+	~BufferPool();
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	/**
+	 * Frees every buffer and sets the size of the buffers handed out from now
+	 * on.
+	 *
+	 * @note Any buffer IDs handed out before this call become invalid.
+	 *
+	 * @param buffer_size Size of each buffer in bytes.
+	 */
+	void reset(int buffer_size);
+
+	/**
+	 * Takes a free buffer out of the pool (allocating a slab of them if there
+	 * are none).
+	 *
+	 * @return ID of the buffer, which starts with a reference count of 1.
+	 */
+	int acquire();
+
+	/**
+	 * Adds a reference to a buffer, so it won't be reused until a matching
+	 * release.
+	 *
+	 * @param id ID of the buffer.
+	 */
+	void retain(int id);
+
+	/**
+	 * Drops a reference to a buffer, returning it to the pool when the last
+	 * one is gone.
+	 *
+	 * @param id ID of the buffer.
+	 */
+	void release(int id);
+
+	/**
+	 * Returns the number of references held on a buffer.
+	 *
+	 * @param id ID of the buffer.
+	 */
+	int ref_count(int id);
+
+	/**
+	 * Returns the memory of a buffer.
+	 *
+	 * @param id ID of the buffer.
+	 */
+	char *get(int id);
+
+	/**
+	 * Returns the number of times the pool has gone to the heap (for a slab,
+	 * or to keep track of one) since it was created.
+	 */
+	uint64_t get_allocations();
+
+private:
+	int 				buffer_size;
+	int 				stride; 			// buffer_size rounded up to a cache line
+	int 				slab_buffers; 		// buffers per slab
+	std::vector<char*> 	slabs;
+	std::vector<int> 	ref_counts; 		// by buffer ID
+	int 				free_head; 			// first free buffer (-1 if none)
+	uint64_t 			allocations;
+
+	/*
+	 * Allocates another slab and puts its buffers on the free list.
+	 */
+	void add_slab();
+};
+
+#endif
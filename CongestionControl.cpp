@@ -0,0 +1,162 @@
+/*
+ * File: CongestionControl.cpp
+ *
+ * Congestion control algorithms for the reliable data transport (RDT) library.
+ *
+ */
+
+#include "CongestionControl.h"
+
+// Number of segments a new connection may send before getting any ACKs
+static const float INITIAL_WINDOW = 10;
+
+// The window never shrinks below this after a (non-timeout) loss
+static const float MIN_WINDOW = 2;
+
+// Effectively infinite slow start threshold
+static const float INITIAL_SSTHRESH = 1e9;
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the CongestionControl header file.
+ */
+
+CongestionController *make_congestion_controller(RDTCongestionAlgorithm algorithm) {
+	switch (algorithm) {
+		case RDT_CC_RENO:
+			return new RenoController();
+		case RDT_CC_DELAY:
+			return new DelayController();
+		case RDT_CC_NONE:
+		default:
+			return new NoCongestionController();
+	}
+}
+
+void NoCongestionController::on_ack(uint32_t, int) {}
+
+void NoCongestionController::on_loss() {}
+
+void NoCongestionController::on_spurious_loss() {}
+
+void NoCongestionController::on_timeout() {}
+
+uint32_t NoCongestionController::get_window() {
+	return UINT32_MAX;
+}
+
+RenoController::RenoController() {
+	this->cwnd 				= INITIAL_WINDOW;
+	this->ssthresh 			= INITIAL_SSTHRESH;
+	this->prior_cwnd 		= this->cwnd;
+	this->prior_ssthresh 	= this->ssthresh;
+}
+
+void RenoController::on_ack(uint32_t num_acked, int) {
+	if (this->cwnd < this->ssthresh) {
+		// Slow start: one more segment for every one ACKed
+		this->cwnd += num_acked;
+	} else {
+		// Congestion avoidance: about one more segment per RTT
+		this->cwnd += num_acked / this->cwnd;
+	}
+}
+
+void RenoController::on_loss() {
+	this->prior_cwnd 		= this->cwnd;
+	this->prior_ssthresh 	= this->ssthresh;
+	this->ssthresh 	= (this->cwnd / 2 > MIN_WINDOW) ? this->cwnd / 2 : MIN_WINDOW;
+	this->cwnd 		= this->ssthresh;
+}
+
+void RenoController::on_spurious_loss() {
+	if (this->cwnd < this->prior_cwnd) {
+		this->cwnd = this->prior_cwnd;
+	}
+	this->ssthresh = this->prior_ssthresh;
+}
+
+void RenoController::on_timeout() {
+	this->ssthresh 	= (this->cwnd / 2 > MIN_WINDOW) ? this->cwnd / 2 : MIN_WINDOW;
+	this->cwnd 		= 1;
+}
+
+uint32_t RenoController::get_window() {
+	return (this->cwnd < 1) ? 1 : (uint32_t)this->cwnd;
+}
+
+DelayController::DelayController() {
+	this->cwnd 				= INITIAL_WINDOW;
+	this->ssthresh 			= INITIAL_SSTHRESH;
+	this->prior_cwnd 		= this->cwnd;
+	this->prior_ssthresh 	= this->ssthresh;
+	this->base_rtt 			= -1;
+	this->min_rtt 			= -1;
+	this->acked_this_round 	= 0;
+}
+
+void DelayController::on_ack(uint32_t num_acked, int rtt_us) {
+	if (rtt_us >= 0) {
+		if (this->base_rtt < 0 || rtt_us < this->base_rtt) {
+			this->base_rtt = rtt_us;
+		}
+		if (this->min_rtt < 0 || rtt_us < this->min_rtt) {
+			this->min_rtt = rtt_us;
+		}
+	}
+
+	if (this->cwnd < this->ssthresh) {
+		this->cwnd += num_acked;
+	}
+
+	// Only adjust once per round trip (i.e. once a window's worth is ACKed)
+	this->acked_this_round += num_acked;
+	if (this->acked_this_round < this->cwnd) {
+		return;
+	}
+
+	if (this->min_rtt > 0) {
+		// Estimated number of our segments sitting in queues
+		float queued = this->cwnd * (this->min_rtt - this->base_rtt) / this->min_rtt;
+
+		if (this->cwnd < this->ssthresh) {
+			if (queued > ALPHA) {
+				// Queues are building: leave slow start
+				this->ssthresh = this->cwnd;
+			}
+		} else if (queued < ALPHA) {
+			this->cwnd += 1;
+		} else if (queued > BETA && this->cwnd > MIN_WINDOW) {
+			this->cwnd -= 1;
+		}
+	} else if (this->cwnd >= this->ssthresh) {
+		// RTT too small to measure, so there can't be much queueing
+		this->cwnd += 1;
+	}
+
+	this->acked_this_round 	= 0;
+	this->min_rtt 			= -1;
+}
+
+void DelayController::on_loss() {
+	this->prior_cwnd 		= this->cwnd;
+	this->prior_ssthresh 	= this->ssthresh;
+	this->ssthresh 	= (this->cwnd / 2 > MIN_WINDOW) ? this->cwnd / 2 : MIN_WINDOW;
+	this->cwnd 		= this->ssthresh;
+}
+
+void DelayController::on_spurious_loss() {
+	if (this->cwnd < this->prior_cwnd) {
+		this->cwnd = this->prior_cwnd;
+	}
+	this->ssthresh = this->prior_ssthresh;
+}
+
+void DelayController::on_timeout() {
+	this->ssthresh 	= (this->cwnd / 2 > MIN_WINDOW) ? this->cwnd / 2 : MIN_WINDOW;
+	this->cwnd 		= 1;
+}
+
+uint32_t DelayController::get_window() {
+	return (this->cwnd < 1) ? 1 : (uint32_t)this->cwnd;
+}
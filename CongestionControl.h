@@ -0,0 +1,138 @@
+/*
+ * File: CongestionControl.h
+ *
+ * Header / API file for the congestion control component of the RDT library.
+ * A ReliableSocket asks its CongestionController how many segments it may
+ * have in flight, and tells it about every ACK, loss and timeout.
+ *
+ */
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+#include <cstdint>
+
+/**
+ * The congestion control algorithms a ReliableSocket can use.
+ *
+ * RDT_CC_NONE:  No congestion control (only the send window limits us).
+ * RDT_CC_RENO:  Reno-style AIMD: slow start, then additive increase, halving
+ *               the window on loss.
+ * RDT_CC_DELAY: Vegas-style delay based control: keeps a small, fixed number
+ *               of segments queued in the network by comparing the RTT to the
+ *               lowest RTT seen so far.
+ */
+enum RDTCongestionAlgorithm { RDT_CC_NONE, RDT_CC_RENO, RDT_CC_DELAY };
+
+/**
+ * Interface for congestion control algorithms. All windows are measured in
+ * segments.
+ */
+class CongestionController {
+public:
+	virtual ~CongestionController() {}
+
+	/**
+	 * Called when an ACK acknowledges new data.
+	 *
+	 * @param num_acked Number of segments that were newly acknowledged.
+	 * @param rtt_us RTT sample taken from this ACK, or -1 if there is none.
+	 */
+	virtual void on_ack(uint32_t num_acked, int rtt_us) = 0;
+
+	/**
+	 * Called when a segment is found to be lost without a timeout (e.g. from
+	 * duplicate ACKs or SACK blocks).
+	 */
+	virtual void on_loss() = 0;
+
+	/**
+	 * Called when the last loss (see on_loss) turns out to have been
+	 * reordering: the segment wasn't lost after all. Undoes the window
+	 * reduction.
+	 */
+	virtual void on_spurious_loss() = 0;
+
+	/**
+	 * Called when the retransmission timer expires.
+	 */
+	virtual void on_timeout() = 0;
+
+	/**
+	 * Returns the congestion window.
+	 *
+	 * @return The number of segments allowed in flight.
+	 */
+	virtual uint32_t get_window() = 0;
+};
+
+/**
+ * Congestion controller that never limits the sender.
+ */
+class NoCongestionController final : public CongestionController {
+public:
+	void on_ack(uint32_t num_acked, int rtt_us);
+	void on_loss();
+	void on_spurious_loss();
+	void on_timeout();
+	uint32_t get_window();
+};
+
+/**
+ * Reno-style additive increase / multiplicative decrease.
+ */
+class RenoController final : public CongestionController {
+public:
+	RenoController();
+
+	void on_ack(uint32_t num_acked, int rtt_us);
+	void on_loss();
+	void on_spurious_loss();
+	void on_timeout();
+	uint32_t get_window();
+
+private:
+	float 		cwnd;
+	float 		ssthresh;
+
+	// The window before the last loss, for on_spurious_loss
+	float 		prior_cwnd;
+	float 		prior_ssthresh;
+};
+
+/**
+ * Vegas-style delay based controller. Once per RTT it estimates how many of
+ * its segments are sitting in queues, (cwnd * (1 - base_rtt / rtt)), and
+ * grows the window if that is below ALPHA or shrinks it if above BETA.
+ */
+class DelayController final : public CongestionController {
+public:
+	DelayController();
+
+	void on_ack(uint32_t num_acked, int rtt_us);
+	void on_loss();
+	void on_spurious_loss();
+	void on_timeout();
+	uint32_t get_window();
+
+private:
+	static const int ALPHA = 2;
+	static const int BETA  = 4;
+
+	float 		cwnd;
+	float 		ssthresh;
+	float 		prior_cwnd;
+	float 		prior_ssthresh;
+	int 		base_rtt; 		// lowest RTT seen (us)
+	int 		min_rtt; 		// lowest RTT seen this round (us)
+	uint32_t 	acked_this_round;
+};
+
+/**
+ * Creates a congestion controller that uses the given algorithm.
+ *
+ * @param algorithm The algorithm to use.
+ * @return A new controller (the caller is responsible for deleting it).
+ */
+CongestionController *make_congestion_controller(RDTCongestionAlgorithm algorithm);
+
+#endif
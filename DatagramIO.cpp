@@ -0,0 +1,357 @@
+/*
+ * File: DatagramIO.cpp
+ *
+ * Batched datagram I/O for the reliable data transport (RDT) library.
+ *
+ */
+
+// C++ library includes
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// OS specific includes
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "DatagramIO.h"
+
+// Older headers may not know about UDP GSO/GRO (Linux 4.18 / 5.0)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the DatagramIO header file.
+ */
+
+DatagramIO::DatagramIO() {
+	this->transport 			= NULL;
+	this->max_datagram_size 	= 0;
+	this->send_only 			= false;
+	this->has_peer 				= false;
+	this->gso_enabled 			= false;
+	this->gro_enabled 			= false;
+	this->num_send_iovs 		= 0;
+	this->num_queued 			= 0;
+	this->num_received 			= 0;
+	this->next_received 		= 0;
+	this->recv_offset 			= 0;
+	this->recv_segment_size 	= 0;
+	this->recv_timeout_ms 		= -1;
+	memset(&this->peer, 0, sizeof(this->peer));
+	memset(&this->stats, 0, sizeof(this->stats));
+	memset(this->send_msgs, 0, sizeof(this->send_msgs));
+	memset(this->recv_msgs, 0, sizeof(this->recv_msgs));
+}
+
+void DatagramIO::attach(DatagramTransport *transport, int max_datagram_size, bool send_only) {
+	this->transport = transport;
+	this->send_only = send_only;
+	this->set_max_datagram_size(max_datagram_size);
+}
+
+void DatagramIO::set_max_datagram_size(int max_datagram_size) {
+	this->max_datagram_size = max_datagram_size;
+	this->layout_recv_buffers();
+}
+
+void DatagramIO::set_peer(const struct sockaddr_in *addr) {
+	this->peer 		= *addr;
+	this->has_peer 	= true;
+}
+
+bool DatagramIO::set_offload(bool enabled) {
+	// Setting a GSO size of 0 changes nothing, but tells us if the kernel
+	// knows about UDP_SEGMENT at all.
+	int gso_size = 0;
+	this->gso_enabled = enabled && this->transport->set_option(SOL_UDP, UDP_SEGMENT, 
+									&gso_size, sizeof(gso_size)) == 0;
+
+	int gro = enabled ? 1 : 0;
+	this->gro_enabled = this->transport->set_option(SOL_UDP, UDP_GRO, 
+									&gro, sizeof(gro)) == 0 && enabled;
+	this->layout_recv_buffers();
+
+	return this->gso_enabled || this->gro_enabled;
+}
+
+void DatagramIO::layout_recv_buffers() {
+	if (this->send_only) {
+		return;
+	}
+
+	int buffer_size = this->gro_enabled ? MAX_OFFLOAD_SIZE : this->max_datagram_size;
+	this->recv_pool.reset(buffer_size);
+	this->num_received 	= 0;
+	this->next_received = 0;
+	this->recv_offset 	= 0;
+
+	for (int i = 0; i < BATCH_SIZE; i++) {
+		this->recv_buffer_ids[i] 	= this->recv_pool.acquire();
+		this->recv_iovs[i].iov_base = this->recv_pool.get(this->recv_buffer_ids[i]);
+		this->recv_iovs[i].iov_len 	= buffer_size;
+		this->recv_msgs[i].msg_hdr.msg_iov 		= &this->recv_iovs[i];
+		this->recv_msgs[i].msg_hdr.msg_iovlen 	= 1;
+		this->recv_msgs[i].msg_hdr.msg_name 	= &this->recv_addrs[i];
+	}
+}
+
+void DatagramIO::replace_retained_buffers() {
+	for (int i = 0; i < this->num_received; i++) {
+		int id = this->recv_buffer_ids[i];
+		if (this->recv_pool.ref_count(id) > 1) {
+			this->recv_pool.release(id);
+			this->recv_buffer_ids[i] 	= this->recv_pool.acquire();
+			this->recv_iovs[i].iov_base = this->recv_pool.get(this->recv_buffer_ids[i]);
+		}
+	}
+}
+
+void DatagramIO::retain(int buffer_id) {
+	this->recv_pool.retain(buffer_id);
+}
+
+int DatagramIO::acquire(char **data) {
+	int buffer_id 	= this->recv_pool.acquire();
+	*data 			= this->recv_pool.get(buffer_id);
+	return buffer_id;
+}
+
+void DatagramIO::release(int buffer_id) {
+	this->recv_pool.release(buffer_id);
+}
+
+void DatagramIO::queue_send(const void *data, int length) {
+	struct iovec iov;
+	iov.iov_base 	= (void*)data;
+	iov.iov_len 	= length;
+	this->queue_send(&iov, 1);
+}
+
+void DatagramIO::queue_send(const struct iovec *iov, int iovcnt) {
+	if (this->num_queued == BATCH_SIZE) {
+		this->flush_sends();
+	}
+
+	int i = this->num_queued;
+	this->send_first_iov[i] 	= this->num_send_iovs;
+	this->send_iov_counts[i] 	= iovcnt;
+	this->send_lengths[i] 		= 0;
+	for (int j = 0; j < iovcnt; j++) {
+		this->send_iovs[this->num_send_iovs++] = iov[j];
+		this->send_lengths[i] += iov[j].iov_len;
+	}
+	this->num_queued++;
+}
+
+void DatagramIO::queue_send_copy(const void *data, int length) {
+	if (length > MAX_COPY_SIZE) {
+		// It would run into the next batch slot's copy
+		errno = EMSGSIZE;
+		perror("queue_send_copy");
+		return;
+	}
+	if (this->num_queued == BATCH_SIZE) {
+		this->flush_sends();
+	}
+
+	// Each batch slot has its own spot in send_copies
+	char *copy = this->send_copies[this->num_queued];
+	memcpy(copy, data, length);
+	this->queue_send(copy, length);
+}
+
+int DatagramIO::build_send_msgs(int first) {
+	int num_msgs = 0;
+	int i = first;
+	while (i < this->num_queued) {
+		// With GSO, keep adding datagrams while they're the same size as the
+		// first one. The last one in a run is allowed to be shorter.
+		int run_size = this->send_lengths[i];
+		int run_length = 1;
+		int run_bytes = run_size;
+		int run_iovs = this->send_iov_counts[i];
+		while (this->gso_enabled && i + run_length < this->num_queued) {
+			int next_size = this->send_lengths[i + run_length];
+			if (next_size > run_size || run_bytes + next_size > MAX_OFFLOAD_SIZE) {
+				break;
+			}
+
+			run_iovs += this->send_iov_counts[i + run_length];
+			run_length++;
+			run_bytes += next_size;
+			if (next_size < run_size) {
+				break;
+			}
+		}
+
+		struct msghdr *hdr = &this->send_msgs[num_msgs].msg_hdr;
+		hdr->msg_name 		= this->has_peer ? &this->peer : NULL;
+		hdr->msg_namelen 	= this->has_peer ? sizeof(this->peer) : 0;
+		hdr->msg_iov 		= &this->send_iovs[this->send_first_iov[i]];
+		hdr->msg_iovlen 	= run_iovs;
+		hdr->msg_control 	= NULL;
+		hdr->msg_controllen = 0;
+
+		if (run_length > 1) {
+			// Let the kernel split this into run_size datagrams
+			hdr->msg_control 	= this->send_control[num_msgs];
+			hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level 	= SOL_UDP;
+			cmsg->cmsg_type 	= UDP_SEGMENT;
+			cmsg->cmsg_len 		= CMSG_LEN(sizeof(uint16_t));
+			uint16_t segment_size = run_size;
+			memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+		}
+
+		this->send_runs[num_msgs] = run_length;
+		num_msgs++;
+		i += run_length;
+	}
+
+	return num_msgs;
+}
+
+void DatagramIO::flush_sends() {
+	int num_sent = 0;
+	while (num_sent < this->num_queued) {
+		int num_msgs = this->build_send_msgs(num_sent);
+		int result = this->transport->send_batch(this->send_msgs, num_msgs);
+		this->stats.send_calls++;
+		if (result < 0 && this->gso_enabled && (errno == EIO || errno == EINVAL)) {
+			// The kernel knows about GSO but can't do it on this route, so
+			// send them one at a time from now on.
+			this->gso_enabled = false;
+			continue;
+		} else if (result < 0 && errno == EMSGSIZE) {
+			// Too big to leave without being fragmented (e.g. a path MTU
+			// probe): it's lost, as if it were dropped on the way
+			num_sent += this->send_runs[0];
+			continue;
+		} else if (result < 0) {
+			// Whatever didn't go out will be retransmitted later. A full
+			// socket buffer (on a non-blocking socket) is no surprise.
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("sendmmsg");
+			}
+			break;
+		}
+
+		for (int i = 0; i < result; i++) {
+			num_sent += this->send_runs[i];
+			this->stats.packets_sent += this->send_runs[i];
+		}
+	}
+
+	this->num_send_iovs = 0;
+	this->num_queued 	= 0;
+}
+
+int DatagramIO::receive(char **data, int *buffer_id, struct sockaddr_in *from) {
+	if (this->next_received == this->num_received) {
+		this->replace_retained_buffers();
+
+		// The kernel overwrites these with the size of what it gave us
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			this->recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			if (this->gro_enabled) {
+				this->recv_msgs[i].msg_hdr.msg_control 	= this->recv_control[i];
+				this->recv_msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+			}
+		}
+
+		// Take whatever is ready. Only if nothing is do we wait, and then
+		// only for the first datagram.
+		int result = this->transport->receive_batch(this->recv_msgs, BATCH_SIZE);
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) 
+				&& this->recv_timeout_ms != 0) {
+			int num_ready = this->transport->wait_readable(this->recv_timeout_ms);
+			if (num_ready <= 0) {
+				if (num_ready == 0) {
+					errno = EAGAIN;
+				}
+				return -1;
+			}
+
+			result = this->transport->receive_batch(this->recv_msgs, BATCH_SIZE);
+		}
+		if (result <= 0) {
+			return -1;
+		}
+
+		this->stats.recv_calls++;
+		this->num_received 		= result;
+		this->next_received 	= 0;
+		this->recv_offset 		= 0;
+		this->recv_segment_size = this->gro_segment_size(&this->recv_msgs[0]);
+	}
+
+	// Hand out the next datagram from the current (possibly coalesced) message
+	struct mmsghdr *msg = &this->recv_msgs[this->next_received];
+	int length = msg->msg_len - this->recv_offset;
+	if (length > this->recv_segment_size) {
+		length = this->recv_segment_size;
+	}
+	*data = (char*)this->recv_iovs[this->next_received].iov_base + this->recv_offset;
+	if (buffer_id != NULL) {
+		*buffer_id = this->recv_buffer_ids[this->next_received];
+	}
+	if (from != NULL) {
+		*from = this->recv_addrs[this->next_received];
+	}
+	this->stats.packets_received++;
+
+	this->recv_offset += length;
+	if (this->recv_offset >= (int)msg->msg_len) {
+		this->next_received++;
+		this->recv_offset = 0;
+		if (this->next_received < this->num_received) {
+			this->recv_segment_size = 
+				this->gro_segment_size(&this->recv_msgs[this->next_received]);
+		}
+	}
+
+	return length;
+}
+
+int DatagramIO::gro_segment_size(struct mmsghdr *msg) {
+	if (this->gro_enabled) {
+		struct cmsghdr *cmsg;
+		for (cmsg = CMSG_FIRSTHDR(&msg->msg_hdr); cmsg != NULL; 
+				cmsg = CMSG_NXTHDR(&msg->msg_hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+				int segment_size;
+				memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+				return segment_size;
+			}
+		}
+	}
+
+	return msg->msg_len;
+}
+
+void DatagramIO::set_receive_timeout(int timeout_ms) {
+	this->recv_timeout_ms = timeout_ms;
+}
+
+bool DatagramIO::has_pending_receive() {
+	return this->next_received < this->num_received;
+}
+
+RDTIOStats DatagramIO::get_stats() {
+	RDTIOStats stats 		= this->stats;
+	stats.heap_allocations 	= this->recv_pool.get_allocations();
+	return stats;
+}
@@ -0,0 +1,280 @@
+/*
+ * File: DatagramIO.h
+ *
+ * Header / API file for the batched datagram I/O component of the RDT
+ * library. Outgoing datagrams are queued and sent together with sendmmsg, and
+ * incoming datagrams are drained several at a time with recvmmsg.
+ *
+ * In offload mode, runs of equal sized datagrams are handed to the kernel as
+ * a single UDP GSO (UDP_SEGMENT) send, and the kernel may hand us several
+ * datagrams coalesced into one buffer (UDP_GRO).
+ *
+ * The datagrams go through a DatagramTransport: normally a UDP socket, but
+ * anything that takes the same batches will do (offload is only used if the
+ * transport takes the UDP options for it).
+ *
+ */
+#ifndef DATAGRAM_IO_H
+#define DATAGRAM_IO_H
+
+#include <cstdint>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "BufferPool.h"
+#include "DatagramTransport.h"
+
+/**
+ * Counters describing how well batching is working, and how often the data
+ * path had to go to the heap.
+ *
+ * @note Buffer pools and per-segment queues only grow while a connection's
+ * window opens up, so heap_allocations levels off: in the steady state
+ * sending and receiving segments allocates nothing.
+ */
+struct RDTIOStats {
+	uint64_t 	packets_sent;
+	uint64_t 	send_calls; 		// send_batch calls (sendmmsg syscalls)
+	uint64_t 	packets_received;
+	uint64_t 	recv_calls; 		// receive_batch calls that returned data
+	uint64_t 	heap_allocations; 	// by buffer pools and queues
+};
+
+/**
+ * Batched send and receive on a transport: either a connected one, or one
+ * shared by several peers (see set_peer and the from argument of receive).
+ */
+class DatagramIO {
+public:
+	// Maximum number of datagrams handled by a single syscall
+	static const int BATCH_SIZE = 32;
+
+	// Maximum number of pieces (iovecs) a single outgoing datagram can have
+	static const int MAX_DATAGRAM_IOVS = 8;
+
+	// Largest buffer the kernel will hand us with UDP_GRO (and the most we
+	// give it in one UDP_SEGMENT send)
+	static const int MAX_OFFLOAD_SIZE = 65507;
+
+	// Largest datagram queue_send_copy takes (room for a control segment or
+	// an ACK with all its SACK blocks)
+	static const int MAX_COPY_SIZE = 256;
+
+	DatagramIO();
+
+	/**
+	 * Sets the transport to use and the largest datagram we'll send or
+	 * receive.
+	 *
+	 * @param transport The transport (e.g. a UDP socket).
+	 * @param max_datagram_size Size of the largest datagram.
+	 * @param send_only If true, no receive buffers are set up (someone else
+	 * receives on the transport), so receive must not be called.
+	 */
+	void attach(DatagramTransport *transport, int max_datagram_size, bool send_only = false);
+
+	/**
+	 * Changes the size of the largest datagram we'll send or receive.
+	 *
+	 * @note This frees every receive buffer, so it must not be called while
+	 * there are received datagrams pending or any buffer is retained.
+	 *
+	 * @param max_datagram_size Size of the largest datagram.
+	 */
+	void set_max_datagram_size(int max_datagram_size);
+
+	/**
+	 * Sends every datagram to the given address instead of the one the
+	 * transport is connected to. Used when several peers share one transport.
+	 *
+	 * @param addr The peer's address.
+	 */
+	void set_peer(const struct sockaddr_in *addr);
+
+	/**
+	 * Turns UDP GSO/GRO offload on or off. Each is only used if the kernel
+	 * (and the transport) supports it; if GSO sends later fail, we quietly go back to sending
+	 * datagrams one by one.
+	 *
+	 * @note Like set_max_datagram_size, this frees every receive buffer.
+	 *
+	 * @param enabled Whether to try to use offload.
+	 * @return True if at least one of GSO or GRO is now in use.
+	 */
+	bool set_offload(bool enabled);
+
+	/**
+	 * Queues a datagram to be sent. The batch is sent once it is full or
+	 * flush_sends is called.
+	 *
+	 * @note The data is not copied, so it must stay valid (and unchanged)
+	 * until the next flush_sends.
+	 *
+	 * @param data The datagram.
+	 * @param length Length of the datagram.
+	 */
+	void queue_send(const void *data, int length);
+
+	/**
+	 * Queues a datagram made up of several pieces (e.g. a header and the
+	 * application's data), which the kernel gathers together when sending.
+	 *
+	 * @note As with the other queue_send, the pieces are not copied.
+	 *
+	 * @param iov The pieces of the datagram.
+	 * @param iovcnt Number of pieces (at most MAX_DATAGRAM_IOVS).
+	 */
+	void queue_send(const struct iovec *iov, int iovcnt);
+
+	/**
+	 * Like queue_send, but the datagram is copied so the caller can reuse
+	 * its buffer right away. Meant for small segments such as ACKs.
+	 *
+	 * @param data The datagram.
+	 * @param length Length of the datagram. Anything longer than
+	 * MAX_COPY_SIZE is dropped (with an error message).
+	 */
+	void queue_send_copy(const void *data, int length);
+
+	/**
+	 * Sends every queued datagram.
+	 */
+	void flush_sends();
+
+	/**
+	 * Sets how long receive waits for a datagram when none is ready. This is
+	 * just a field (the wait is the transport's wait_readable), so it costs nothing to change it
+	 * before every receive.
+	 *
+	 * @param timeout_ms Longest wait in ms: 0 never waits, -1 (the default)
+	 * waits for as long as it takes.
+	 */
+	void set_receive_timeout(int timeout_ms);
+
+	/**
+	 * Returns the next received datagram. If none are left from the last
+	 * batch, this grabs as many as are ready, waiting (see
+	 * set_receive_timeout) for the first one only if none are.
+	 *
+	 * @param data Set to point at the datagram, which stays valid until the
+	 * next batch is received (or longer, see retain).
+	 * @param buffer_id If not NULL, set to the ID of the buffer holding the
+	 * datagram.
+	 * @param from If not NULL, set to the address the datagram came from.
+	 * @return Length of the datagram, or -1 on error/timeout (with errno set).
+	 */
+	int receive(char **data, int *buffer_id = NULL, struct sockaddr_in *from = NULL);
+
+	/**
+	 * Keeps a receive buffer (and so every datagram in it) from being reused
+	 * until it is released.
+	 *
+	 * @param buffer_id ID of the buffer (from receive).
+	 */
+	void retain(int buffer_id);
+
+	/**
+	 * Takes a spare receive buffer, for data that didn't arrive as a datagram
+	 * (e.g. a segment rebuilt from others). It is given back with release.
+	 *
+	 * @param data Set to point at the buffer (room for the largest datagram).
+	 * @return ID of the buffer.
+	 */
+	int acquire(char **data);
+
+	/**
+	 * Gives back a receive buffer kept with retain.
+	 *
+	 * @param buffer_id ID of the buffer.
+	 */
+	void release(int buffer_id);
+
+	/**
+	 * Returns true if there are received datagrams we haven't handed out.
+	 */
+	bool has_pending_receive();
+
+	/**
+	 * Returns the batching counters.
+	 */
+	RDTIOStats get_stats();
+
+private:
+	// Room for a single control message holding an int (UDP_SEGMENT/UDP_GRO)
+	static const int CONTROL_SIZE = 32;
+
+	DatagramTransport 	*transport;
+	int 				max_datagram_size;
+	bool 				send_only;
+	bool 				gso_enabled;
+	bool 				gro_enabled;
+
+	// Where datagrams go if the socket isn't connected (see set_peer)
+	struct sockaddr_in 	peer;
+	bool 				has_peer;
+
+	// Outgoing batch: the pieces of each queued datagram are laid out one
+	// after another in send_iovs. With GSO, a message may cover the pieces of
+	// several consecutive datagrams.
+	struct mmsghdr 		send_msgs[BATCH_SIZE];
+	int 				send_runs[BATCH_SIZE]; 	// datagrams in each message
+	char 				send_control[BATCH_SIZE][CONTROL_SIZE];
+	struct iovec 		send_iovs[BATCH_SIZE * MAX_DATAGRAM_IOVS];
+	int 				send_first_iov[BATCH_SIZE];
+	int 				send_iov_counts[BATCH_SIZE];
+	int 				send_lengths[BATCH_SIZE];
+	int 				num_send_iovs;
+	int 				num_queued;
+	char 				send_copies[BATCH_SIZE][MAX_COPY_SIZE]; 	// for queue_send_copy
+
+	// Incoming batch. With GRO a single message may hold several datagrams
+	// of recv_segment_size bytes each (the last may be shorter). Each message
+	// is received into a buffer from recv_pool; buffers that someone retained
+	// are swapped for fresh ones before the next batch.
+	struct mmsghdr 		recv_msgs[BATCH_SIZE];
+	char 				recv_control[BATCH_SIZE][CONTROL_SIZE];
+	struct iovec 		recv_iovs[BATCH_SIZE];
+	struct sockaddr_in 	recv_addrs[BATCH_SIZE];
+	int 				recv_buffer_ids[BATCH_SIZE];
+	BufferPool 			recv_pool;
+	int 				num_received;
+	int 				next_received;
+	int 				recv_offset; 		// within recv_msgs[next_received]
+	int 				recv_segment_size;
+	int 				recv_timeout_ms;
+
+	RDTIOStats 			stats;
+
+	/*
+	 * Points each receive message at its own buffer, sized for either single
+	 * datagrams or GRO coalesced ones.
+	 */
+	void layout_recv_buffers();
+
+	/*
+	 * Swaps out any buffer from the last batch that is still held by someone
+	 * else, so the next batch can't overwrite it.
+	 */
+	void replace_retained_buffers();
+
+	/*
+	 * Fills in send_msgs for the queued datagrams starting at first. With GSO
+	 * enabled, runs of equal sized datagrams share a message.
+	 *
+	 * @param first Index of the first datagram to send.
+	 * @return The number of messages filled in.
+	 */
+	int build_send_msgs(int first);
+
+	/*
+	 * Returns the datagram size the kernel reported for a GRO coalesced
+	 * message, or the message length if it wasn't coalesced.
+	 *
+	 * @param msg The received message.
+	 */
+	int gro_segment_size(struct mmsghdr *msg);
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * File: DatagramTransport.cpp
+ *
+ * Datagram transports for the reliable data transport (RDT) library: the
+ * UDP socket one.
+ *
+ */
+
+// C++ library includes
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+// OS specific includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "DatagramTransport.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the DatagramTransport header file.
+ */
+
+int DatagramTransport::send_to(const void *data, int length, const struct sockaddr_in *addr) {
+	struct iovec iov;
+	iov.iov_base 	= (void*)data;
+	iov.iov_len 	= length;
+
+	struct mmsghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_hdr.msg_name 	= (void*)addr;
+	msg.msg_hdr.msg_namelen = sizeof(*addr);
+	msg.msg_hdr.msg_iov 	= &iov;
+	msg.msg_hdr.msg_iovlen 	= 1;
+	return (this->send_batch(&msg, 1) == 1) ? 0 : -1;
+}
+
+UDPTransport::UDPTransport() {
+	this->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (this->sock_fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+}
+
+UDPTransport::~UDPTransport() {
+	if (this->sock_fd >= 0) {
+		::close(this->sock_fd);
+	}
+}
+
+int UDPTransport::get_fd() {
+	return this->sock_fd;
+}
+
+int UDPTransport::bind(const struct sockaddr_in *addr) {
+	return ::bind(this->sock_fd, (const struct sockaddr*)addr, sizeof(*addr));
+}
+
+int UDPTransport::connect(const struct sockaddr_in *addr) {
+	return ::connect(this->sock_fd, (const struct sockaddr*)addr, sizeof(*addr));
+}
+
+int UDPTransport::send_batch(struct mmsghdr *msgs, int num_msgs) {
+	return sendmmsg(this->sock_fd, msgs, num_msgs, 0);
+}
+
+int UDPTransport::receive_batch(struct mmsghdr *msgs, int num_msgs) {
+	return recvmmsg(this->sock_fd, msgs, num_msgs, MSG_DONTWAIT, NULL);
+}
+
+int UDPTransport::wait_readable(int timeout_ms) {
+	struct pollfd readable;
+	readable.fd 		= this->sock_fd;
+	readable.events 	= POLLIN;
+	readable.revents 	= 0;
+	return poll(&readable, 1, timeout_ms);
+}
+
+int UDPTransport::set_option(int level, int name, const void *value, socklen_t length) {
+	return setsockopt(this->sock_fd, level, name, value, length);
+}
+
+int UDPTransport::get_option(int level, int name, void *value, socklen_t *length) {
+	return getsockopt(this->sock_fd, level, name, value, length);
+}
+
+int UDPTransport::set_nonblocking(bool enabled) {
+	int flags = fcntl(this->sock_fd, F_GETFL, 0);
+	if (flags < 0) {
+		return -1;
+	}
+
+	flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(this->sock_fd, F_SETFL, flags);
+}
+
+uint32_t UDPTransport::random() {
+	static std::mt19937 generator(std::random_device{}());
+	return generator();
+}
+
+int UDPTransport::close() {
+	int result 		= ::close(this->sock_fd);
+	this->sock_fd 	= -1;
+	return result;
+}
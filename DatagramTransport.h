@@ -0,0 +1,166 @@
+/*
+ * File: DatagramTransport.h
+ *
+ * Header / API file for what the RDT library sends and receives datagrams
+ * through. Sockets, listeners and their batched I/O only ever talk to a
+ * DatagramTransport, never to a file descriptor, so the protocol can run over
+ * a real UDP socket (UDPTransport) or over something else entirely, such as
+ * the in-process network of SimulatedNetwork.h.
+ *
+ * The calls mirror the socket calls they stand in for: they take the same
+ * structures, and fail by returning -1 with errno set.
+ *
+ */
+#ifndef DATAGRAM_TRANSPORT_H
+#define DATAGRAM_TRANSPORT_H
+
+#include <cstdint>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/**
+ * A datagram endpoint.
+ */
+class DatagramTransport {
+public:
+	DatagramTransport() {}
+	virtual ~DatagramTransport() {}
+
+	DatagramTransport(const DatagramTransport&) = delete;
+	DatagramTransport& operator=(const DatagramTransport&) = delete;
+
+	/**
+	 * Returns the file descriptor behind the transport, for an RDTReactor to
+	 * wait on, or -1 if there is none (so the transport can't be used with
+	 * a reactor).
+	 */
+	virtual int get_fd() = 0;
+
+	/**
+	 * Gives the endpoint a local address (like bind).
+	 *
+	 * @param addr The address.
+	 * @return 0, or -1 with errno set.
+	 */
+	virtual int bind(const struct sockaddr_in *addr) = 0;
+
+	/**
+	 * Sets where datagrams without an address go, and only takes datagrams
+	 * from there (like connect on a UDP socket).
+	 *
+	 * @param addr The remote address.
+	 * @return 0, or -1 with errno set.
+	 */
+	virtual int connect(const struct sockaddr_in *addr) = 0;
+
+	/**
+	 * Sends several datagrams (like sendmmsg).
+	 *
+	 * @param msgs The datagrams. Those without an msg_name go to the
+	 * connected address.
+	 * @param num_msgs Number of datagrams.
+	 * @return The number of datagrams sent, or -1 with errno set.
+	 */
+	virtual int send_batch(struct mmsghdr *msgs, int num_msgs) = 0;
+
+	/**
+	 * Receives whatever datagrams are ready, without waiting (like recvmmsg
+	 * with MSG_DONTWAIT).
+	 *
+	 * @param msgs Where to put them; msg_len is set to each one's length.
+	 * @param num_msgs Most datagrams to take.
+	 * @return The number of datagrams received, or -1 with errno set
+	 * (EAGAIN if none are ready).
+	 */
+	virtual int receive_batch(struct mmsghdr *msgs, int num_msgs) = 0;
+
+	/**
+	 * Waits until a datagram is ready to be received (like poll).
+	 *
+	 * @param timeout_ms Longest wait in ms (-1 for as long as it takes).
+	 * @return 1 if a datagram is ready, 0 on timeout, or -1 with errno set.
+	 */
+	virtual int wait_readable(int timeout_ms) = 0;
+
+	/**
+	 * Sets an option (like setsockopt). Transports that don't know an option
+	 * fail with ENOPROTOOPT, which callers take to mean the feature (e.g.
+	 * UDP offload) isn't available.
+	 *
+	 * @return 0, or -1 with errno set.
+	 */
+	virtual int set_option(int level, int name, const void *value, socklen_t length) = 0;
+
+	/**
+	 * Reads an option (like getsockopt).
+	 *
+	 * @return 0, or -1 with errno set.
+	 */
+	virtual int get_option(int level, int name, void *value, socklen_t *length) = 0;
+
+	/**
+	 * Turns non-blocking mode of the file descriptor on or off. receive_batch
+	 * never waits either way; this is for whoever else waits on get_fd.
+	 *
+	 * @return 0, or -1 with errno set.
+	 */
+	virtual int set_nonblocking(bool enabled) = 0;
+
+	/**
+	 * Returns a random number, for whatever the protocol picks at random
+	 * (e.g. connection IDs). A simulated transport takes these from its
+	 * network's seeded generator, so that runs can be repeated.
+	 */
+	virtual uint32_t random() = 0;
+
+	/**
+	 * Closes the endpoint. Nothing else may be called after this.
+	 *
+	 * @return 0, or -1 with errno set.
+	 */
+	virtual int close() = 0;
+
+	/**
+	 * Sends a single datagram to the given address (like sendto).
+	 *
+	 * @param data The datagram.
+	 * @param length Length of the datagram.
+	 * @param addr Where it goes.
+	 * @return 0, or -1 with errno set.
+	 */
+	int send_to(const void *data, int length, const struct sockaddr_in *addr);
+};
+
+/**
+ * A UDP socket.
+ */
+class UDPTransport : public DatagramTransport {
+public:
+	/**
+	 * Creates a new UDP socket.
+	 */
+	UDPTransport();
+
+	/**
+	 * Closes the socket, unless close already did.
+	 */
+	~UDPTransport();
+
+	int get_fd();
+	int bind(const struct sockaddr_in *addr);
+	int connect(const struct sockaddr_in *addr);
+	int send_batch(struct mmsghdr *msgs, int num_msgs);
+	int receive_batch(struct mmsghdr *msgs, int num_msgs);
+	int wait_readable(int timeout_ms);
+	int set_option(int level, int name, const void *value, socklen_t length);
+	int get_option(int level, int name, void *value, socklen_t *length);
+	int set_nonblocking(bool enabled);
+	uint32_t random();
+	int close();
+
+private:
+	int 				sock_fd; 	// -1 once closed
+};
+
+#endif
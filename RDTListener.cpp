@@ -0,0 +1,304 @@
+/*
+ * File: RDTListener.cpp
+ *
+ * Listener that accepts reliable connections from many remote hosts on one
+ * port.
+ *
+ */
+
+// C++ library includes
+#include <algorithm>
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// OS specific includes
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "RDTListener.h"
+#include "rdt_log.h"
+#include "rdt_time.h"
+
+using std::cerr;
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the RDTListener header file.
+ */
+
+RDTListener::RDTListener() : RDTListener(new UDPTransport()) {
+}
+
+RDTListener::RDTListener(DatagramTransport *transport) : transport(transport) {
+	this->listening 		= false;
+	this->nonblocking 		= false;
+	this->offload_enabled 	= false;
+	this->max_seg_size 		= ReliableSocket::DEFAULT_SEG_SIZE;
+	this->pmtu_probing 		= false;
+	this->fec_block_size 	= 0;
+	this->num_fragmenting 	= 0;
+
+	this->io.attach(this->transport.get(), this->max_seg_size);
+}
+
+RDTListener::~RDTListener() {
+	// Deleting a connection makes it forget itself, so work from copies
+	std::vector<ReliableSocket*> unaccepted(this->handshaking);
+	unaccepted.insert(unaccepted.end(), this->accept_queue.begin(), this->accept_queue.end());
+	for (size_t i = 0; i < unaccepted.size(); i++) {
+		delete unaccepted[i];
+	}
+
+	if (this->transport->close() < 0) {
+		perror("listener close");
+	}
+}
+
+void RDTListener::listen_on(int port_num) {
+	// Let other listeners (in this process or another) share the port
+	int reuse = 1;
+	if (this->transport->set_option(SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+		perror("setsockopt");
+	}
+
+	struct sockaddr_in addr;
+	addr.sin_family 		= AF_INET;
+	addr.sin_port 			= htons(port_num);
+	addr.sin_addr.s_addr 	= INADDR_ANY;
+
+	if (this->transport->bind(&addr)) {
+		perror("bind");
+	}
+	this->listening = true;
+}
+
+ReliableSocket *RDTListener::accept_connection() {
+	while (this->accept_queue.empty()) {
+		if (this->nonblocking) {
+			errno = EAGAIN;
+			return NULL;
+		}
+		this->wait_for_events(NULL);
+	}
+
+	ReliableSocket *conn = this->accept_queue.front();
+	this->accept_queue.pop_front();
+	return conn;
+}
+
+void RDTListener::set_nonblocking(bool enabled) {
+	if (this->transport->set_nonblocking(enabled) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+	this->nonblocking = enabled;
+
+	std::unordered_map<uint64_t, ReliableSocket*>::iterator it;
+	for (it = this->connections.begin(); it != this->connections.end(); ++it) {
+		it->second->nonblocking = enabled;
+	}
+}
+
+bool RDTListener::set_offload_enabled(bool enabled) {
+	if (this->listening) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Offload can only be changed before listening.\n");
+		return this->offload_enabled;
+	}
+
+	this->offload_enabled = this->io.set_offload(enabled);
+	return this->offload_enabled;
+}
+
+void RDTListener::set_max_segment_size(int bytes) {
+	if (this->listening) {
+		RDT_LOG(RDT_LOG_ERROR, "Cannot change the segment size of a listener that is listening\n");
+		return;
+	}
+
+	if (bytes < ReliableSocket::MIN_SEG_SIZE) {
+		bytes = ReliableSocket::MIN_SEG_SIZE;
+	} else if (bytes > ReliableSocket::MAX_SEG_SIZE) {
+		bytes = ReliableSocket::MAX_SEG_SIZE;
+	}
+	this->max_seg_size = bytes;
+	this->io.set_max_datagram_size(bytes);
+}
+
+void RDTListener::set_pmtu_probing(bool enabled) {
+	int discover = enabled ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT;
+	if (this->transport->set_option(IPPROTO_IP, IP_MTU_DISCOVER, 
+									&discover, sizeof(discover)) < 0) {
+		perror("setsockopt");
+		return;
+	}
+	this->pmtu_probing = enabled;
+}
+
+void RDTListener::set_fragmenting(bool enabled) {
+	this->num_fragmenting += enabled ? 1 : -1;
+	if (this->num_fragmenting != (enabled ? 1 : 0)) {
+		// Already allowed (or still wanted by someone else)
+		return;
+	}
+
+	int discover = enabled ? IP_PMTUDISC_DONT : IP_PMTUDISC_PROBE;
+	if (this->transport->set_option(IPPROTO_IP, IP_MTU_DISCOVER, 
+									&discover, sizeof(discover)) < 0) {
+		perror("setsockopt");
+	}
+}
+
+void RDTListener::set_fec_block_size(uint32_t num_segments) {
+	if (num_segments > ReliableSocket::MAX_FEC_BLOCK_SIZE) {
+		num_segments = ReliableSocket::MAX_FEC_BLOCK_SIZE;
+	}
+	this->fec_block_size = num_segments;
+}
+
+size_t RDTListener::num_connections() {
+	return this->connections.size();
+}
+
+uint64_t RDTListener::connection_key(const struct sockaddr_in *addr, uint16_t connection_id) {
+	return ((uint64_t)ntohl(addr->sin_addr.s_addr) << 32)
+			| ((uint64_t)ntohs(addr->sin_port) << 16) | connection_id;
+}
+
+bool RDTListener::receive_segments(std::vector<ReliableSocket*> *touched,
+								   std::vector<ReliableSocket*> *created) {
+	char *segment;
+	int buffer_id;
+	struct sockaddr_in fromaddr;
+	int recv_count = this->io.receive(&segment, &buffer_id, &fromaddr);
+	if (recv_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		perror("listener recv");
+		exit(EXIT_FAILURE);
+	} else if (recv_count < 0) {
+		return false;
+	}
+
+	// Handle the whole batch without blocking again
+	while (recv_count >= 0) {
+		RDTHeader *hdr = (RDTHeader*)segment;
+		ReliableSocket *conn = NULL;
+		if (recv_count >= (int)sizeof(RDTHeader)) {
+			uint64_t key = connection_key(&fromaddr, ntohs(hdr->connection_id));
+			std::unordered_map<uint64_t, ReliableSocket*>::iterator it =
+				this->connections.find(key);
+			if (it != this->connections.end()) {
+				conn = it->second;
+				conn->process_segment(segment, recv_count, buffer_id);
+			} else if (!ReliableSocket::checksum_ok(segment, recv_count, false)) {
+				RDT_LOG(RDT_LOG_DEBUG, "Listener received a corrupted segment.\n");
+			} else if (hdr->type == RDT_SYN) {
+				conn = new ReliableSocket(this, &fromaddr);
+				this->connections[key] = conn;
+				conn->receiver_handshake(hdr, recv_count);
+				if (created != NULL) {
+					created->push_back(conn);
+				}
+			} else if (hdr->type == RDT_FIN) {
+				// We've already closed this connection, so the FINACK for
+				// this FIN must have been lost
+				RDTHeader finack;
+				memset(&finack, 0, sizeof(finack));
+				finack.type 			= RDT_FINACK;
+				finack.connection_id 	= hdr->connection_id;
+				finack.timestamp 		= htonl((uint32_t)current_usec());
+				finack.timestamp_echo 	= hdr->timestamp;
+				ReliableSocket::set_checksum(&finack, NULL, 0);
+				this->transport->send_to(&finack, sizeof(finack), &fromaddr);
+			}
+		}
+
+		if (conn != NULL && touched != NULL) {
+			touched->push_back(conn);
+		}
+
+		if (!this->io.has_pending_receive()) {
+			break;
+		}
+		recv_count = this->io.receive(&segment, &buffer_id, &fromaddr);
+	}
+
+	return true;
+}
+
+void RDTListener::wait_for_events(ReliableSocket *caller) {
+	// Everything the caller queued has to go out before we block
+	if (caller != NULL) {
+		caller->io.flush_sends();
+		caller->update_timer();
+	}
+
+	// Only wait until the first connection's timer runs out (or forever if
+	// none is running)
+	std::vector<ReliableSocket*> touched;
+	std::vector<ReliableSocket*> created;
+	int time_left = this->timers.next_expiry(current_msec());
+	if (time_left != 0) {
+		this->io.set_receive_timeout(time_left);
+		this->receive_segments(&touched, &created);
+	}
+
+	uint32_t now = current_msec();
+	RDTTimer *timer;
+	while ((timer = this->timers.expire(now)) != NULL) {
+		touched.push_back((ReliableSocket*)timer->data);
+	}
+
+	// Only the connections that had something to do have anything to send
+	std::sort(touched.begin(), touched.end());
+	touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+	for (size_t i = 0; i < touched.size(); i++) {
+		touched[i]->process_timeouts();
+		touched[i]->io.flush_sends();
+		touched[i]->update_timer();
+	}
+
+	// Established connections are ready for accept_connection. Those whose
+	// handshake was given up on are nobody else's, so they go.
+	this->handshaking.insert(this->handshaking.end(), created.begin(), created.end());
+	for (size_t i = 0; i < this->handshaking.size(); ) {
+		ReliableSocket *conn = this->handshaking[i];
+		if (conn->state == SYN_ACK) {
+			i++;
+			continue;
+		}
+
+		this->handshaking.erase(this->handshaking.begin() + i);
+		if (conn->state == CLOSED) {
+			delete conn;
+		} else {
+			this->accept_queue.push_back(conn);
+		}
+	}
+}
+
+void RDTListener::forget(ReliableSocket *conn) {
+	std::unordered_map<uint64_t, ReliableSocket*>::iterator it =
+		this->connections.find(connection_key(&conn->peer_addr, conn->connection_id));
+	if (it != this->connections.end() && it->second == conn) {
+		this->connections.erase(it);
+	}
+	if (conn->timer_wheel == &this->timers) {
+		this->timers.cancel(&conn->timer);
+		conn->timer_wheel = NULL;
+	}
+	if (conn->fragmenting) {
+		conn->set_fragmenting(false);
+	}
+}
+
+void RDTListener::remove(ReliableSocket *conn) {
+	this->forget(conn);
+	this->handshaking.erase(std::remove(this->handshaking.begin(),
+								this->handshaking.end(), conn), this->handshaking.end());
+	this->accept_queue.erase(std::remove(this->accept_queue.begin(),
+								this->accept_queue.end(), conn), this->accept_queue.end());
+}
@@ -0,0 +1,224 @@
+/*
+ * File: RDTListener.h
+ *
+ * Header / API file for a listener that accepts reliable connections from
+ * any number of remote hosts on a single UDP port. Every segment arrives on
+ * the listener's one socket; the listener hands it to the connection it
+ * belongs to by the remote host's address and the segment's connection ID.
+ *
+ * Several listeners (e.g. one per thread or core) can share a port: they
+ * bind it with SO_REUSEPORT, and the kernel then spreads the remote hosts
+ * across them by address, so every segment of a connection reaches the same
+ * listener.
+ *
+ */
+#ifndef RDT_LISTENER_H
+#define RDT_LISTENER_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "DatagramIO.h"
+#include "DatagramTransport.h"
+#include "ReliableSocket.h"
+#include "TimerWheel.h"
+
+/**
+ * Accepts connections from many remote hosts on one port.
+ */
+class RDTListener {
+public:
+	/**
+	 * Creates a listener on a UDP socket of its own.
+	 */
+	RDTListener();
+
+	/**
+	 * Creates a listener that receives through the given transport instead,
+	 * e.g. an endpoint of a SimulatedNetwork.
+	 *
+	 * @note Only a transport with a file descriptor (see get_fd) can be used
+	 * with an RDTReactor.
+	 *
+	 * @param transport The transport. The listener takes ownership of it.
+	 */
+	explicit RDTListener(DatagramTransport *transport);
+
+	/**
+	 * Closes the listener's transport and deletes connections that were
+	 * never accepted.
+	 *
+	 * @note Accepted connections use the listener's transport, so they must
+	 * be closed (and deleted) first.
+	 */
+	~RDTListener();
+
+	/**
+	 * Binds the port that remote hosts connect to. Other listeners may bind
+	 * the same port to share the work.
+	 *
+	 * @param port_num The port number to listen on.
+	 */
+	void listen_on(int port_num);
+
+	/**
+	 * Waits for a remote host to connect, looking after the connections
+	 * that were already accepted in the meantime.
+	 *
+	 * @note Only for blocking mode; with a reactor, the listener's
+	 * on_connected callback hands over each new connection instead.
+	 *
+	 * @return The new connection. It belongs to the caller, who deletes it
+	 * once it is closed.
+	 */
+	ReliableSocket *accept_connection();
+
+	/**
+	 * Turns non-blocking mode on or off for the listener and its connections
+	 * (an RDTReactor turns it on when the listener is added to it).
+	 *
+	 * @param enabled Whether to use non-blocking mode.
+	 */
+	void set_nonblocking(bool enabled);
+
+	/**
+	 * Turns on UDP GSO/GRO offload for the listener and its connections (see
+	 * ReliableSocket::set_offload_enabled).
+	 *
+	 * @note Only before listen_on: this replaces the receive buffers, which
+	 * connections hold on to.
+	 *
+	 * @param enabled Whether to use offload.
+	 * @return True if GSO and/or GRO is actually in use.
+	 */
+	bool set_offload_enabled(bool enabled);
+
+	/**
+	 * Sets the largest segment the listener and its connections take (see
+	 * ReliableSocket::set_max_segment_size).
+	 *
+	 * @note Only before listen_on: this replaces the receive buffers, which
+	 * connections hold on to.
+	 *
+	 * @param bytes The segment size.
+	 */
+	void set_max_segment_size(int bytes);
+
+	/**
+	 * Turns path MTU probing on or off for the connections accepted after
+	 * this (see ReliableSocket::set_pmtu_probing).
+	 *
+	 * @param enabled Whether to probe.
+	 */
+	void set_pmtu_probing(bool enabled);
+
+	/**
+	 * Sets the FEC block size of the connections accepted after this (see
+	 * ReliableSocket::set_fec_block_size).
+	 *
+	 * @param num_segments Data segments per repair segment (0 for none).
+	 */
+	void set_fec_block_size(uint32_t num_segments);
+
+	/**
+	 * Returns the number of connections (accepted or not) that aren't closed.
+	 */
+	size_t num_connections();
+
+private:
+	// Connections send through our transport, and the reactor drives us
+	friend class ReliableSocket;
+	friend class RDTReactor;
+
+	std::unique_ptr<DatagramTransport> transport;
+	bool 				listening; 		// listen_on was called
+	bool 				nonblocking;
+	bool 				offload_enabled;
+	int 				max_seg_size;
+	bool 				pmtu_probing;
+	uint32_t 			fec_block_size;
+
+	// Connections that let their segments be fragmented (see
+	// ReliableSocket::set_fragmenting): while there are any, the transport
+	// does so for all of them
+	int 				num_fragmenting;
+
+	// Batched receives for every connection
+	DatagramIO 			io;
+
+	// Open connections by connection_key
+	std::unordered_map<uint64_t, ReliableSocket*> connections;
+
+	// Blocking mode: connections still in the handshake, and established
+	// ones waiting for accept_connection
+	std::vector<ReliableSocket*> 	handshaking;
+	std::deque<ReliableSocket*> 	accept_queue;
+
+	// Blocking mode: every connection's next deadline (with a reactor, the
+	// connections use the reactor's wheel instead)
+	TimerWheel 						timers;
+
+	/*
+	 * Returns the key a connection is found under: the remote host's address
+	 * and port, and the connection ID.
+	 *
+	 * @param addr Address of the remote host.
+	 * @param connection_id The connection ID (in host byte order).
+	 */
+	static uint64_t connection_key(const struct sockaddr_in *addr, uint16_t connection_id);
+
+	/*
+	 * Receives a batch of segments and hands each one to its connection,
+	 * creating a connection for every new SYN.
+	 *
+	 * @param touched If not NULL, every connection that was handed a segment
+	 * is added to it (possibly more than once).
+	 * @param created If not NULL, every new connection is added to it.
+	 * @return False if nothing was received (a timeout, or EAGAIN).
+	 */
+	bool receive_segments(std::vector<ReliableSocket*> *touched,
+						  std::vector<ReliableSocket*> *created);
+
+	/*
+	 * Waits for segments to arrive (or until a connection's timer expires)
+	 * and handles them, then sends whatever the connections that had
+	 * something to do queued. This is what the blocking calls of the
+	 * listener and its connections loop on.
+	 *
+	 * @param caller The connection that is waiting (NULL if none); anything
+	 * it queued is sent before we block.
+	 */
+	void wait_for_events(ReliableSocket *caller);
+
+	/*
+	 * Lets segments sent through the transport be fragmented for as long as
+	 * any connection wants it.
+	 *
+	 * @param enabled Whether a connection starts (true) or stops (false)
+	 * wanting it.
+	 */
+	void set_fragmenting(bool enabled);
+
+	/*
+	 * Stops handing segments to a connection because it closed. One that
+	 * wasn't accepted yet stays in handshaking or accept_queue: it is deleted
+	 * from there, or handed over closed.
+	 *
+	 * @param conn The connection.
+	 */
+	void forget(ReliableSocket *conn);
+
+	/*
+	 * Drops every reference to a connection that is being deleted.
+	 *
+	 * @param conn The connection.
+	 */
+	void remove(ReliableSocket *conn);
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * File: RDTPolicy.h
+ *
+ * Header / API file for the protocol policies the RDT library is built with.
+ *
+ * Like the log level (see rdt_log.h), each policy is picked when building,
+ * e.g. `make clean all ARQ=GO_BACK_N CONGESTION=RENO CHECKSUM=NONE`, so the
+ * socket's hot paths are compiled for exactly that configuration: whatever a
+ * policy rules out is compiled out, and a congestion controller picked this
+ * way is called directly instead of through its virtual functions.
+ *
+ * Every object file built against the library must agree on the policies.
+ * The socket's layout is the same whatever they are, but its code isn't:
+ * linking objects built with different policies fails with an undefined
+ * reference to RDTPolicyCheck<...>::linked (see below).
+ *
+ * RDT_ARQ_POLICY: how lost segments are recovered. RDT_ARQ_SELECTIVE_REPEAT,
+ * 		RDT_ARQ_GO_BACK_N or RDT_ARQ_STOP_AND_WAIT.
+ * RDT_CONGESTION_POLICY: the congestion controller. RDT_CONGESTION_DYNAMIC
+ * 		(picked at run time with set_congestion_control, Reno until then),
+ * 		RDT_CONGESTION_RENO, RDT_CONGESTION_DELAY or RDT_CONGESTION_NONE.
+ * RDT_CHECKSUM_POLICY: how segments are checked for corruption.
+ * 		RDT_CHECKSUM_CRC32C or RDT_CHECKSUM_NONE (leaving it to UDP).
+ *
+ * The defaults are selective repeat, the dynamic congestion controller and
+ * CRC32C. Both ends of a connection needn't agree on any of these: they only
+ * change how each end behaves, and an end without checksums says so in its
+ * SYN or SYNACK (by leaving RDT_FLAG_CHECKSUM clear), so the other end doesn't
+ * check what it sends. (A selective repeat sender does recover slowly from
+ * losses when the receiver drops whatever arrives out of order, though.)
+ *
+ */
+#ifndef RDT_POLICY_H
+#define RDT_POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <sys/uio.h>
+
+#include "CongestionControl.h"
+#include "crc32c.h"
+
+/**
+ * Selective repeat: the receiver holds on to segments that arrive out of
+ * order (and reports them in SACK blocks), and the sender only resends what
+ * is missing: the oldest segment on duplicate ACKs or a timeout, plus any
+ * holes the SACK blocks show.
+ */
+struct RDTSelectiveRepeat {
+	static const bool 		BUFFER_OUT_OF_ORDER = true; 	// receiver keeps segments past a gap
+	static const bool 		FAST_RETRANSMIT 	= true; 	// resend on duplicate ACKs
+	static const bool 		GO_BACK 			= false; 	// a timeout resends everything in flight
+	static const uint32_t 	MAX_WINDOW 			= 0; 		// most segments in flight (0 for any)
+};
+
+/**
+ * Go-Back-N: the receiver drops anything that arrives out of order, so when
+ * the retransmission timer runs out every segment in flight is resent.
+ */
+struct RDTGoBackN {
+	static const bool 		BUFFER_OUT_OF_ORDER = false;
+	static const bool 		FAST_RETRANSMIT 	= false;
+	static const bool 		GO_BACK 			= true;
+	static const uint32_t 	MAX_WINDOW 			= 0;
+};
+
+/**
+ * Stop-and-wait: a single segment in flight at a time.
+ */
+struct RDTStopAndWait {
+	static const bool 		BUFFER_OUT_OF_ORDER = false;
+	static const bool 		FAST_RETRANSMIT 	= false;
+	static const bool 		GO_BACK 			= true;
+	static const uint32_t 	MAX_WINDOW 			= 1;
+};
+
+/**
+ * Congestion controller picked at run time (see make_congestion_controller).
+ * Starts out as Reno.
+ */
+class RDTDynamicCongestion {
+public:
+	RDTDynamicCongestion() : controller(make_congestion_controller(RDT_CC_RENO)) {}
+
+	/**
+	 * Replaces the controller with a new one.
+	 *
+	 * @param algorithm The algorithm to use.
+	 * @return true (this policy can always switch).
+	 */
+	bool select(RDTCongestionAlgorithm algorithm) {
+		this->controller.reset(make_congestion_controller(algorithm));
+		return true;
+	}
+
+	CongestionController *operator->() {
+		return this->controller.get();
+	}
+
+private:
+	std::unique_ptr<CongestionController> controller;
+};
+
+/**
+ * Congestion controller fixed when building. Since the controllers are
+ * final, it is called without virtual dispatch. It is held the same way as
+ * the dynamic one so that the socket's layout doesn't depend on the policy.
+ */
+template <typename Controller>
+class RDTStaticCongestion {
+public:
+	RDTStaticCongestion() : controller(new Controller()) {}
+
+	/**
+	 * Does nothing: the algorithm can't be changed.
+	 *
+	 * @return false.
+	 */
+	bool select(RDTCongestionAlgorithm) {
+		return false;
+	}
+
+	Controller *operator->() {
+		return static_cast<Controller*>(this->controller.get());
+	}
+
+private:
+	std::unique_ptr<CongestionController> controller;
+};
+
+/**
+ * CRC32C over the header (up to the checksum field) and the payload. A sum
+ * that comes out as 0 is sent as 0xffffffff instead, since 0 means the
+ * sender didn't compute one.
+ */
+struct RDTCrc32cChecksum {
+	static const bool ENABLED = true;
+
+
+	static uint32_t compute(const void *header, size_t header_length,
+							const struct iovec *payload, int iovcnt) {
+		uint32_t crc = crc32c(header, header_length);
+		for (int i = 0; i < iovcnt; i++) {
+			crc = crc32c_extend(crc, payload[i].iov_base, payload[i].iov_len);
+		}
+		return (crc != 0) ? crc : 0xffffffff;
+	}
+};
+
+/**
+ * No checksum of our own: segments go out with a checksum of 0, and nothing
+ * that arrives is checked.
+ */
+struct RDTNoChecksum {
+	static const bool ENABLED = false;
+
+
+	static uint32_t compute(const void *, size_t, const struct iovec *, int) {
+		return 0;
+	}
+};
+
+// Values for the build settings
+#define RDT_ARQ_SELECTIVE_REPEAT 	RDTSelectiveRepeat
+#define RDT_ARQ_GO_BACK_N 			RDTGoBackN
+#define RDT_ARQ_STOP_AND_WAIT 		RDTStopAndWait
+#define RDT_CONGESTION_DYNAMIC 		RDTDynamicCongestion
+#define RDT_CONGESTION_RENO 		RDTStaticCongestion<RenoController>
+#define RDT_CONGESTION_DELAY 		RDTStaticCongestion<DelayController>
+#define RDT_CONGESTION_NONE 		RDTStaticCongestion<NoCongestionController>
+#define RDT_CHECKSUM_CRC32C 		RDTCrc32cChecksum
+#define RDT_CHECKSUM_NONE 			RDTNoChecksum
+
+#ifndef RDT_ARQ_POLICY
+#define RDT_ARQ_POLICY RDT_ARQ_SELECTIVE_REPEAT
+#endif
+#ifndef RDT_CONGESTION_POLICY
+#define RDT_CONGESTION_POLICY RDT_CONGESTION_DYNAMIC
+#endif
+#ifndef RDT_CHECKSUM_POLICY
+#define RDT_CHECKSUM_POLICY RDT_CHECKSUM_CRC32C
+#endif
+
+// The policies this build uses
+typedef RDT_ARQ_POLICY 			RDTArqPolicy;
+typedef RDT_CONGESTION_POLICY 	RDTCongestionPolicy;
+typedef RDT_CHECKSUM_POLICY 	RDTChecksumPolicy;
+
+/**
+ * Link-time check that every object agrees on the policies. ReliableSocket.cpp
+ * defines linked only for the policies it was built with, and every file that
+ * includes this one refers to it for the policies it was built with, so any
+ * mismatch is left undefined.
+ */
+template <typename Arq, typename Congestion, typename Checksum>
+struct RDTPolicyCheck {
+	static const int linked;
+};
+
+template <>
+const int RDTPolicyCheck<RDTArqPolicy, RDTCongestionPolicy, RDTChecksumPolicy>::linked;
+
+namespace {
+__attribute__((used)) const int *const rdt_policy_check =
+	&RDTPolicyCheck<RDTArqPolicy, RDTCongestionPolicy, RDTChecksumPolicy>::linked;
+}
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * File: RDTReactor.cpp
+ *
+ * Event loop for non-blocking reliable sockets.
+ *
+ */
+
+// C++ library includes
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+// OS specific includes
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "RDTReactor.h"
+#include "rdt_time.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the RDTReactor header file.
+ */
+
+RDTReactor::RDTReactor() {
+	this->epoll_fd = epoll_create1(0);
+	if (this->epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+}
+
+RDTReactor::~RDTReactor() {
+	while (!this->listeners.empty()) {
+		this->remove_listener(this->listeners.begin()->first);
+	}
+	while (!this->connections.empty()) {
+		this->remove(this->connections.begin()->first);
+	}
+	close(this->epoll_fd);
+}
+
+void RDTReactor::add(ReliableSocket *socket, const RDTCallbacks &callbacks) {
+	socket->set_nonblocking(true);
+	socket->reactor = this;
+
+	Connection &conn 	= this->connections[socket];
+	conn.callbacks 		= callbacks;
+	conn.connected 		= false;
+
+	// A listener's connections may have been on the listener's wheel
+	if (socket->timer_wheel != NULL) {
+		socket->timer_wheel->cancel(&socket->timer);
+	}
+	socket->timer_wheel = &this->timers;
+
+	// Level triggered, so a socket we only drained one batch from comes
+	// straight back on the next run_once. A listener's connections share
+	// its transport, which is watched on the listener's behalf.
+	if (socket->listener == NULL) {
+		struct epoll_event event;
+		event.events 	= EPOLLIN;
+		event.data.ptr 	= socket;
+		if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, socket->transport->get_fd(), &event) < 0) {
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	socket->update_timer();
+}
+
+void RDTReactor::add_listener(RDTListener *listener, const RDTCallbacks &callbacks) {
+	listener->set_nonblocking(true);
+	this->listeners[listener] = callbacks;
+
+	struct epoll_event event;
+	event.events 	= EPOLLIN;
+	event.data.ptr 	= listener;
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, listener->transport->get_fd(), &event) < 0) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void RDTReactor::remove_listener(RDTListener *listener) {
+	if (this->listeners.erase(listener) > 0) {
+		epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, listener->transport->get_fd(), NULL);
+	}
+}
+
+void RDTReactor::remove(ReliableSocket *socket) {
+	std::unordered_map<ReliableSocket*, Connection>::iterator it =
+		this->connections.find(socket);
+	if (it == this->connections.end()) {
+		return;
+	}
+
+	this->timers.cancel(&socket->timer);
+	socket->timer_wheel = NULL;
+	this->connections.erase(it);
+
+	// A CLOSED socket's fd is gone, and with it its epoll registration
+	if (socket->state != CLOSED && socket->listener == NULL) {
+		epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, socket->transport->get_fd(), NULL);
+	}
+	socket->reactor = NULL;
+}
+
+size_t RDTReactor::size() {
+	return this->connections.size();
+}
+
+void RDTReactor::run() {
+	while (!this->connections.empty() || !this->listeners.empty()) {
+		this->run_once(-1);
+	}
+}
+
+int RDTReactor::run_once(int max_wait_ms) {
+	// Don't sleep past the first timer
+	int timeout 	= max_wait_ms;
+	int time_left 	= this->timers.next_expiry(current_msec());
+	if (time_left >= 0 && (timeout < 0 || time_left < timeout)) {
+		timeout = time_left;
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	int num_events = epoll_wait(this->epoll_fd, events, MAX_EVENTS, timeout);
+	if (num_events < 0 && errno != EINTR) {
+		perror("epoll_wait");
+		exit(EXIT_FAILURE);
+	} else if (num_events < 0) {
+		num_events = 0;
+	}
+
+	int num_handled = 0;
+	for (int i = 0; i < num_events; i++) {
+		RDTListener *listener = (RDTListener*)events[i].data.ptr;
+		if (this->listeners.count(listener) > 0) {
+			num_handled += this->handle_listener(listener);
+			continue;
+		}
+
+		ReliableSocket *socket = (ReliableSocket*)events[i].data.ptr;
+		if (this->connections.count(socket) == 0) {
+			// Removed by a callback earlier in this round
+			continue;
+		}
+
+		// One batch each, so a busy connection can't starve the others
+		if (socket->state == LISTEN) {
+			socket->listen_for_syn();
+		} else if (socket->state != CLOSED) {
+			socket->receive_segments();
+		}
+		socket->process_timeouts();
+		socket->io.flush_sends();
+
+		this->dispatch(socket);
+		num_handled++;
+	}
+
+	uint32_t now = current_msec();
+	RDTTimer *timer;
+	while ((timer = this->timers.expire(now)) != NULL) {
+		ReliableSocket *socket = (ReliableSocket*)timer->data;
+		if (socket->state != CLOSED) {
+			socket->process_timeouts();
+			socket->io.flush_sends();
+		}
+
+		this->dispatch(socket);
+		num_handled++;
+	}
+
+	return num_handled;
+}
+
+int RDTReactor::handle_listener(RDTListener *listener) {
+	std::vector<ReliableSocket*> touched;
+	std::vector<ReliableSocket*> created;
+	listener->receive_segments(&touched, &created);
+
+	for (size_t i = 0; i < created.size(); i++) {
+		this->add(created[i], this->listeners[listener]);
+	}
+
+	// A connection may have had several segments in the batch
+	std::sort(touched.begin(), touched.end());
+	touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+	for (size_t i = 0; i < touched.size(); i++) {
+		ReliableSocket *socket = touched[i];
+		if (this->connections.count(socket) == 0) {
+			// Removed (and maybe deleted) by a callback earlier in this round
+			continue;
+		}
+
+		socket->process_timeouts();
+		socket->io.flush_sends();
+		this->dispatch(socket);
+	}
+
+	return touched.size();
+}
+
+void RDTReactor::dispatch(ReliableSocket *socket) {
+	// The callbacks may remove (and then delete) the socket, so it has to be
+	// looked up again after each one. They're also copied before they're
+	// called, since removing a socket destroys its callbacks.
+	std::unordered_map<ReliableSocket*, Connection>::iterator it =
+		this->connections.find(socket);
+	if (it == this->connections.end()) {
+		return;
+	}
+
+	if (!it->second.connected
+			&& (socket->state == ESTABLISHED || socket->state == FIN_STATE)) {
+		it->second.connected = true;
+		std::function<void(ReliableSocket&)> callback = it->second.callbacks.on_connected;
+		if (callback) {
+			callback(*socket);
+			if ((it = this->connections.find(socket)) == this->connections.end()) {
+				return;
+			}
+		}
+	}
+
+	if (socket->is_readable() && it->second.callbacks.on_readable) {
+		std::function<void(ReliableSocket&)> callback = it->second.callbacks.on_readable;
+		callback(*socket);
+		if ((it = this->connections.find(socket)) == this->connections.end()) {
+			return;
+		}
+	}
+
+	if (socket->is_writable() && it->second.callbacks.on_writable) {
+		std::function<void(ReliableSocket&)> callback = it->second.callbacks.on_writable;
+		callback(*socket);
+		if ((it = this->connections.find(socket)) == this->connections.end()) {
+			return;
+		}
+	}
+
+	if (socket->state == CLOSED && !it->second.connected && socket->listener != NULL) {
+		// A listener's connection that never got established was never
+		// handed over to the application, so it's ours to delete
+		this->remove(socket);
+		delete socket;
+	} else if (socket->state == CLOSED) {
+		std::function<void(ReliableSocket&)> callback = it->second.callbacks.on_closed;
+		this->remove(socket);
+		if (callback) {
+			callback(*socket);
+		}
+	} else {
+		socket->update_timer();
+	}
+}
@@ -0,0 +1,143 @@
+/*
+ * File: RDTReactor.h
+ *
+ * Header / API file for the event loop that drives non-blocking reliable
+ * sockets. A single thread can run many connections at once: the reactor
+ * waits (with epoll) for any of their sockets to become readable or for one
+ * of their timers to run out, lets the socket handle it, and then tells the
+ * application what it can do next through callbacks.
+ *
+ */
+#ifndef RDT_REACTOR_H
+#define RDT_REACTOR_H
+
+#include <functional>
+#include <unordered_map>
+
+#include "RDTListener.h"
+#include "ReliableSocket.h"
+#include "TimerWheel.h"
+
+/**
+ * Callbacks for a socket added to a reactor. Any of them may be left empty.
+ * They're called from run_once, and may use any non-blocking socket call
+ * (including close_connection) and add or remove sockets.
+ *
+ * on_connected: 	the connection was established
+ * on_readable: 	receive_view has data (or the end of the stream) ready;
+ * 					called after every event until it has all been read
+ * on_writable: 	send_data has room in the send window; called after every
+ * 					event while there is room
+ * on_closed: 		the connection is CLOSED and the socket was removed from
+ * 					the reactor (so it may be deleted)
+ */
+struct RDTCallbacks {
+	std::function<void(ReliableSocket&)> 	on_connected;
+	std::function<void(ReliableSocket&)> 	on_readable;
+	std::function<void(ReliableSocket&)> 	on_writable;
+	std::function<void(ReliableSocket&)> 	on_closed;
+};
+
+/**
+ * Event loop for any number of non-blocking ReliableSockets.
+ */
+class RDTReactor {
+public:
+	// Maximum number of epoll events handled per run_once
+	static const int MAX_EVENTS = 256;
+
+	RDTReactor();
+	~RDTReactor();
+
+	/**
+	 * Starts driving a socket, switching it to non-blocking mode. It can be
+	 * added before or after calling connect_to_remote or accept_connection.
+	 *
+	 * @param socket The socket (which must outlive its time in the reactor).
+	 * @param callbacks What to call when something happens on it.
+	 */
+	void add(ReliableSocket *socket, const RDTCallbacks &callbacks);
+
+	/**
+	 * Stops driving a socket (sockets are removed automatically once they're
+	 * CLOSED). Its callbacks won't be called again.
+	 *
+	 * @param socket The socket to remove.
+	 */
+	void remove(ReliableSocket *socket);
+
+	/**
+	 * Starts driving a listener (switching it to non-blocking mode) and every
+	 * connection it accepts from now on. Each new connection is added with
+	 * the given callbacks; on_connected is where the application takes it
+	 * over (it then owns it, and deletes it once it's closed). A connection
+	 * whose handshake never completes is deleted by the reactor instead.
+	 *
+	 * @param listener The listener (which must outlive its connections).
+	 * @param callbacks What to call when something happens on a connection.
+	 */
+	void add_listener(RDTListener *listener, const RDTCallbacks &callbacks);
+
+	/**
+	 * Stops driving a listener. The connections it already accepted are
+	 * still driven until they're removed.
+	 *
+	 * @param listener The listener to remove.
+	 */
+	void remove_listener(RDTListener *listener);
+
+	/**
+	 * Waits for readable sockets or expired timers and handles them.
+	 *
+	 * @param max_wait_ms Longest time to wait (-1 to wait until something
+	 * happens).
+	 * @return The number of sockets that had something to do.
+	 */
+	int run_once(int max_wait_ms);
+
+	/**
+	 * Runs until there are no sockets (or listeners) left.
+	 */
+	void run();
+
+	/**
+	 * Returns the number of sockets being driven.
+	 */
+	size_t size();
+
+private:
+	// Ours only; everything else about a connection lives in its socket
+	struct Connection {
+		RDTCallbacks 	callbacks;
+		bool 			connected; 		// on_connected was called
+	};
+
+	int 												epoll_fd;
+	std::unordered_map<ReliableSocket*, Connection> 	connections;
+
+	// Listeners, with the callbacks for the connections they accept
+	std::unordered_map<RDTListener*, RDTCallbacks> 		listeners;
+
+	// Every socket's next deadline (each socket keeps its timer on here
+	// up to date itself, see ReliableSocket::update_timer)
+	TimerWheel 											timers;
+
+	/*
+	 * Receives a batch on a listener's socket, adds the connections it
+	 * accepted, and dispatches every connection that got a segment.
+	 *
+	 * @param listener The listener.
+	 * @return The number of connections that had something to do.
+	 */
+	int handle_listener(RDTListener *listener);
+
+	/*
+	 * Lets the application know what it can do with a socket after it has
+	 * handled an event, then removes it if it's CLOSED or updates its timer.
+	 *
+	 * @param socket The socket.
+	 */
+	void dispatch(ReliableSocket *socket);
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * File: RDTStats.cpp
+ *
+ * Per-connection statistics for the reliable data transport (RDT) library.
+ *
+ */
+
+#include "RDTStats.h"
+#include "rdt_time.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the RDTStats header file.
+ */
+
+RDTStatCounters::RDTStatCounters() {
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		this->counters[i].store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < RDT_RTT_BUCKETS; i++) {
+		this->rtt_buckets[i].store(0, std::memory_order_relaxed);
+	}
+	this->start_msec.store(0, std::memory_order_relaxed);
+	this->end_msec.store(0, std::memory_order_relaxed);
+}
+
+void RDTStatCounters::add(Counter counter, int64_t amount) {
+	// There is only one writer, so this needn't be an atomic read-modify-write
+	std::atomic<uint64_t> &value = this->counters[counter];
+	value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void RDTStatCounters::record_rtt(int rtt) {
+	int bucket = 0;
+	while (bucket < RDT_RTT_BUCKETS - 1 && rtt >= (1 << bucket)) {
+		bucket++;
+	}
+
+	std::atomic<uint64_t> &value = this->rtt_buckets[bucket];
+	value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void RDTStatCounters::mark_start(uint32_t now) {
+	this->start_msec.store(now, std::memory_order_relaxed);
+}
+
+void RDTStatCounters::mark_end(uint32_t now) {
+	if (this->end_msec.load(std::memory_order_relaxed) == 0) {
+		this->end_msec.store(now, std::memory_order_relaxed);
+	}
+}
+
+RDTStats RDTStatCounters::snapshot() {
+	RDTStats stats;
+	stats.segments_sent 	= this->counters[SEGMENTS_SENT].load(std::memory_order_relaxed);
+	stats.segments_received = this->counters[SEGMENTS_RECEIVED].load(std::memory_order_relaxed);
+	stats.corrupt_segments 	= this->counters[CORRUPT_SEGMENTS].load(std::memory_order_relaxed);
+	stats.retransmissions 	= this->counters[RETRANSMISSIONS].load(std::memory_order_relaxed);
+	stats.fast_retransmits 	= this->counters[FAST_RETRANSMITS].load(std::memory_order_relaxed);
+	stats.duplicate_acks 	= this->counters[DUPLICATE_ACKS].load(std::memory_order_relaxed);
+	stats.out_of_order_acks = this->counters[OUT_OF_ORDER_ACKS].load(std::memory_order_relaxed);
+	stats.timeouts 			= this->counters[TIMEOUTS].load(std::memory_order_relaxed);
+	stats.fec_segments_sent = this->counters[FEC_SEGMENTS_SENT].load(std::memory_order_relaxed);
+	stats.fec_rebuilt 		= this->counters[FEC_REBUILT].load(std::memory_order_relaxed);
+	stats.bytes_in_flight 	= this->counters[BYTES_IN_FLIGHT].load(std::memory_order_relaxed);
+	stats.bytes_acked 		= this->counters[BYTES_ACKED].load(std::memory_order_relaxed);
+	stats.bytes_delivered 	= this->counters[BYTES_DELIVERED].load(std::memory_order_relaxed);
+	for (int i = 0; i < RDT_RTT_BUCKETS; i++) {
+		stats.rtt_histogram[i] = this->rtt_buckets[i].load(std::memory_order_relaxed);
+	}
+
+	// A connection that is still open is timed up to now
+	uint32_t start 	= this->start_msec.load(std::memory_order_relaxed);
+	uint32_t end 	= this->end_msec.load(std::memory_order_relaxed);
+	if (start == 0) {
+		stats.duration_ms = 0;
+	} else {
+		stats.duration_ms = ((end != 0) ? end : (uint32_t)current_msec()) - start;
+	}
+
+	stats.goodput = 0;
+	if (stats.duration_ms > 0) {
+		stats.goodput = (stats.bytes_acked + stats.bytes_delivered) * 1000.0
+						/ stats.duration_ms;
+	}
+
+	return stats;
+}
@@ -0,0 +1,125 @@
+/*
+ * File: RDTStats.h
+ *
+ * Header / API file for the per-connection statistics of the RDT library.
+ *
+ * A connection updates its counters from whichever thread drives it, while
+ * any other thread may take a snapshot at any time (e.g. to scrape them into
+ * monitoring during a long transfer). The counters are relaxed atomics with
+ * a single writer, so updating one costs a plain load and store.
+ *
+ */
+#ifndef RDT_STATS_H
+#define RDT_STATS_H
+
+#include <atomic>
+#include <cstdint>
+
+// Number of RTT histogram buckets. Bucket 0 counts samples under 1 us and
+// bucket i (i > 0) those in [2^(i-1), 2^i) us; the last one (from about 4 s)
+// also counts anything longer.
+static const int RDT_RTT_BUCKETS = 24;
+
+/**
+ * A snapshot of a connection's statistics.
+ *
+ * @note The counters are read one at a time, so a snapshot taken while the
+ * connection is busy may be off by the events of a few microseconds between
+ * its first and last counter.
+ */
+struct RDTStats {
+	uint64_t 	segments_sent; 		// every segment, including ACKs and resends
+	uint64_t 	segments_received; 	// every segment for this connection
+	uint64_t 	corrupt_segments; 	// segments dropped for a bad checksum
+	uint64_t 	retransmissions; 	// data segments sent again
+	uint64_t 	fast_retransmits; 	// ... of which on duplicate ACKs
+	uint64_t 	duplicate_acks; 	// ACKs for the start of the window
+	uint64_t 	out_of_order_acks; 	// ACKs from before the start of the window
+	uint64_t 	timeouts; 			// expiries of the retransmission timer
+	uint64_t 	fec_segments_sent; 	// FEC repair segments
+	uint64_t 	fec_rebuilt; 		// lost data segments rebuilt from them
+	uint64_t 	bytes_in_flight; 	// data sent but not acknowledged yet
+	uint64_t 	bytes_acked; 		// data the remote host acknowledged
+	uint64_t 	bytes_delivered; 	// data handed to the application
+	uint32_t 	duration_ms; 		// since established (until closing)
+	double 		goodput; 			// acked plus delivered bytes per second
+	uint64_t 	rtt_histogram[RDT_RTT_BUCKETS];
+};
+
+/**
+ * The live counters behind RDTStats.
+ */
+class RDTStatCounters {
+public:
+	enum Counter {
+		SEGMENTS_SENT,
+		SEGMENTS_RECEIVED,
+		CORRUPT_SEGMENTS,
+		RETRANSMISSIONS,
+		FAST_RETRANSMITS,
+		DUPLICATE_ACKS,
+		OUT_OF_ORDER_ACKS,
+		TIMEOUTS,
+		FEC_SEGMENTS_SENT,
+		FEC_REBUILT,
+		BYTES_IN_FLIGHT,
+		BYTES_ACKED,
+		BYTES_DELIVERED,
+		NUM_COUNTERS
+	};
+
+	RDTStatCounters();
+
+	RDTStatCounters(const RDTStatCounters&) = delete;
+	RDTStatCounters& operator=(const RDTStatCounters&) = delete;
+
+	/**
+	 * Adds to a counter.
+	 *
+	 * @note Only the thread driving the connection may call this.
+	 *
+	 * @param counter The counter.
+	 * @param amount What to add (negative to take away).
+	 */
+	void add(Counter counter, int64_t amount = 1);
+
+	/**
+	 * Counts an RTT sample in the histogram.
+	 *
+	 * @param rtt The sample (us).
+	 */
+	void record_rtt(int rtt);
+
+	/**
+	 * Marks when the connection was established.
+	 *
+	 * @param now The current time (ms).
+	 */
+	void mark_start(uint32_t now);
+
+	/**
+	 * Marks when the connection started closing (either side sent a FIN).
+	 * Only the first call counts.
+	 *
+	 * @param now The current time (ms).
+	 */
+	void mark_end(uint32_t now);
+
+	/**
+	 * Reads every counter. Safe to call from any thread.
+	 *
+	 * @return The snapshot.
+	 */
+	RDTStats snapshot();
+
+private:
+	std::atomic<uint64_t> 	counters[NUM_COUNTERS];
+	std::atomic<uint64_t> 	rtt_buckets[RDT_RTT_BUCKETS];
+
+	// When the connection was established and started closing (ms, 0 if not
+	// yet)
+	std::atomic<uint32_t> 	start_msec;
+	std::atomic<uint32_t> 	end_msec;
+};
+
+#endif
@@ -11,6 +11,8 @@
 
 // C++ library includes
 #include <iostream>
+#include <cerrno>
+#include <cstddef>
 #include <cstring>
 
 // OS specific includes
@@ -19,39 +21,188 @@
 #include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "ReliableSocket.h"
+#include "RDTListener.h"
+#include "RDTReactor.h"
+#include "rdt_log.h"
 #include "rdt_time.h"
 
-using std::cerr;
 using std::memcpy;
 using std::memset;
+
+// What path MTU probes are padded with
+static const char probe_padding[ReliableSocket::MAX_DATA_SIZE] = { 0 };
+
+// The policies this was built with (see RDTPolicy.h)
+template <>
+const int RDTPolicyCheck<RDTArqPolicy, RDTCongestionPolicy, RDTChecksumPolicy>::linked = 1;
 /*
  * NOTE: Function header comments shouldn't go in this file: they should be put
  * in the ReliableSocket header file.
  */
 
-ReliableSocket::ReliableSocket() {
-	this->sequence_number 			= 0;
-	this->expected_sequence_number 	= 0;
-	this->estimated_rtt 			= 100;
-	this->dev_rtt 					= 10;
+/*
+ * XORs length bytes of src into dst, a word at a time.
+ */
+static void xor_into(char *dst, const char *src, size_t length) {
+	while (length >= sizeof(uint64_t)) {
+		uint64_t word, other;
+		memcpy(&word, dst, sizeof(word));
+		memcpy(&other, src, sizeof(other));
+		word ^= other;
+		memcpy(dst, &word, sizeof(word));
+		dst 	+= sizeof(word);
+		src 	+= sizeof(word);
+		length 	-= sizeof(word);
+	}
+	while (length > 0) {
+		*dst++ ^= *src++;
+		length--;
+	}
+}
 
-	//creates socket file descriptor
-	this->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-	if (this->sock_fd < 0) {
-		perror("socket");
-		exit(EXIT_FAILURE);
+/*
+ * Writes out all of the pieces, however many calls it takes.
+ *
+ * @return 0, or -1 (with errno set) if a write failed.
+ */
+static int write_fully(int fd, struct iovec *iov, int iovcnt) {
+	while (iovcnt > 0) {
+		ssize_t written = writev(fd, iov, iovcnt);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		} else if (written < 0) {
+			return -1;
+		}
+
+		// Skip what went out, which may end partway through a piece
+		while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base 	= (char*)iov->iov_base + written;
+			iov->iov_len 	-= written;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Returns a mask of the lowest n bits (n at most 64).
+ */
+static uint64_t low_bits(uint32_t n) {
+	return (n >= 64) ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+}
+
+ReliableSocket::ReliableSocket() : ReliableSocket(new UDPTransport()) {
+}
+
+ReliableSocket::ReliableSocket(DatagramTransport *transport) {
+	this->transport = transport;
+	this->owned_transport.reset(transport);
+	this->init(false);
+	this->listener 	= NULL;
+	this->recv_io 	= &this->io;
+	memset(&this->peer_addr, 0, sizeof(this->peer_addr));
+}
+
+ReliableSocket::ReliableSocket(RDTListener *listener, const struct sockaddr_in *peer_addr) {
+	// The listener's transport isn't connected, so every send says where to go
+	this->transport = listener->transport.get();
+	this->init(true);
+	this->timer_wheel = &listener->timers;
+	this->listener 	= listener;
+	this->recv_io 	= &listener->io;
+	this->peer_addr = *peer_addr;
+	this->io.set_peer(peer_addr);
+	this->io.set_offload(listener->offload_enabled);
+	this->nonblocking 	= listener->nonblocking;
+	this->max_seg_size 	= listener->max_seg_size;
+	this->pmtu_probing 	= listener->pmtu_probing;
+	this->fec_block_size 	= listener->fec_block_size;
+}
+
+ReliableSocket::~ReliableSocket() {
+	if (this->reactor != NULL) {
+		this->reactor->remove(this);
 	}
+	if (this->listener != NULL) {
+		this->listener->remove(this);
+	}
+	if (this->timer_wheel != NULL) {
+		this->timer_wheel->cancel(&this->timer);
+	}
+}
+
+void ReliableSocket::init(bool send_only) {
+	this->sequence_number 			= 0;
+	this->expected_sequence_number 	= 0;
+	this->estimated_rtt 			= 100000;
+	this->dev_rtt 					= 10000;
+	this->window_size 				= DEFAULT_WINDOW_SIZE;
+	this->min_timeout_us 			= DEFAULT_MIN_TIMEOUT_US;
+	this->echo_timestamp 			= 0;
+	this->retransmit_timer_start 	= 0;
+	this->control_transmissions 	= 0;
+	this->dup_acks 					= 0;
+	this->dup_ack_threshold 		= DEFAULT_DUP_ACK_THRESHOLD;
+	this->in_recovery 				= false;
+	this->recovery_point 			= 0;
+	this->recovery_inflation 		= 0;
+	this->recovery_start 			= 0;
+	this->recovery_undo_possible 	= false;
+	this->max_seg_size 				= DEFAULT_SEG_SIZE;
+	this->seg_size_limit 			= DEFAULT_SEG_SIZE;
+	this->seg_size 					= DEFAULT_SEG_SIZE;
+	this->pmtu_probing 				= false;
+	this->probe_size 				= 0;
+	this->probe_ceiling 			= DEFAULT_SEG_SIZE;
+	this->probe_sent 				= 0;
+	this->probe_transmissions 		= 0;
+	this->consecutive_timeouts 		= 0;
+	this->fragmenting 				= false;
+	this->fragment_until 			= 0;
+	this->peer_window_edge 			= REASSEMBLY_BUFFER_SIZE;
+	this->advertised_window_edge 	= REASSEMBLY_BUFFER_SIZE;
+	this->send_stalled 				= false;
+	this->recv_buffer_segments 		= REASSEMBLY_BUFFER_SIZE;
+	this->fec_block_size 			= 0;
+	this->fec_buffer_id 			= -1;
+	this->fec_length 				= 0;
+	this->fec_length_xor 			= 0;
+	this->peer_fec_block_size 		= 0;
+	this->sack_enabled 				= true;
+	this->peer_checksums 			= false;
+	this->nonblocking 				= false;
+	this->close_pending 			= false;
+	this->reactor 					= NULL;
+	this->timer_wheel 				= NULL;
+	this->connection_id 			= 0;
+	init_timer(&this->timer, this);
 
+	this->io.attach(this->transport, DEFAULT_SEG_SIZE, send_only);
 	this->state = INIT;
+
+	// Ask for room for a full reassembly buffer's worth of segments in the
+	// socket's receive buffer (the kernel may give us less)
+	if (!send_only) {
+		int size = REASSEMBLY_BUFFER_SIZE * (DEFAULT_SEG_SIZE + RECV_BUFFER_OVERHEAD);
+		this->transport->set_option(SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	this->measure_receive_buffer();
 }
 
 void ReliableSocket::accept_connection(int port_num) {
 	if (this->state != INIT) {
-		cerr << "Cannot call accept on used socket\n";
+		RDT_LOG(RDT_LOG_ERROR, "Cannot call accept on used socket\n");
 		exit(EXIT_FAILURE);
 	}
 	
@@ -62,21 +213,45 @@ void ReliableSocket::accept_connection(int port_num) {
 	addr.sin_port 			= htons(port_num);
 	addr.sin_addr.s_addr 	= INADDR_ANY;
 
-	if (bind(this->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+	if (this->transport->bind(&addr)) {
 		perror("bind");
 	}
 
 	// Wait for a segment to come from a remote host
-	char segment[MAX_SEG_SIZE];
-	memset(segment, 0, MAX_SEG_SIZE);
+	this->state = LISTEN;
+	if (this->nonblocking) {
+		this->update_timer();
+		return;
+	}
+
+	while (this->state == LISTEN || this->state == SYN_ACK) {
+		this->wait_for_events();
+	}
+}
 
+bool ReliableSocket::listen_for_syn() {
+	char *segment;
 	struct sockaddr_in fromaddr;
-	unsigned int addrlen 	= sizeof(fromaddr);
-	int recv_count 			= recvfrom(this->sock_fd, segment, MAX_SEG_SIZE, 0, 
-	(struct sockaddr*)&fromaddr, &addrlen);
-	if (recv_count < 0) {
+	int recv_count = this->io.receive(&segment, NULL, &fromaddr);
+	if (recv_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
 		perror("accept recvfrom");
 		exit(EXIT_FAILURE);
+	} else if (recv_count < 0) {
+		return false;
+	}
+
+	// Check that segment was the right type of message, namely a RDT_SYN
+	// message to indicate that the remote host wants to start a new
+	// connection with us.
+	// (Until its SYN says so, we don't know whether the sender checksums.)
+	RDTHeader* hdr = (RDTHeader*)segment;
+	if (recv_count >= (int)sizeof(RDTHeader) && !checksum_ok(segment, recv_count, false)) {
+		RDT_LOG(RDT_LOG_DEBUG, "Received segment was corrupted.\n");
+		this->stats.add(RDTStatCounters::CORRUPT_SEGMENTS);
+		return true;
+	} else if (recv_count < (int)sizeof(RDTHeader) || hdr->type != RDT_SYN) {
+		RDT_LOG(RDT_LOG_WARN, "ERROR: Didn't get the expected RDT_SYN type.\n");
+		return true;
 	}
 
 	/*
@@ -85,131 +260,38 @@ void ReliableSocket::accept_connection(int port_num) {
 	 * This means we can then use send and recv instead of the more complex
 	 * sendto and recvfrom.
 	 */
-	if (connect(this->sock_fd, (struct sockaddr*)&fromaddr, addrlen)) {
+	if (this->transport->connect(&fromaddr)) {
 		perror("accept connect");
 		exit(EXIT_FAILURE);
 	}
 
-	// TODO: You should implement a handshaking protocol to make sure that
-	// both sides are correctly connected (e.g. what happens if the RDT_CONN
-	// message from the other end gets lost?)
-	// Note that this function is called by the connection receiver/listener.
-	if(this->receiver_handshake(segment)) {
-		// Returned true so we are connected
-		cerr << "Connection Established\n";
-		this->state = ESTABLISHED;
-	} else {
-		cerr << "Connection not Established\n";
-	}
-}
-
-bool ReliableSocket::receiver_handshake(char received_segment[MAX_SEG_SIZE]) {
-	// Get SYN message
-	// Check that segment was the right type of message, namely a RDT_SYN
-	// message to indicate that the remote host wants to start a new
-	// connection with us.
-	RDTHeader* hdr = (RDTHeader*)received_segment;
-	if (hdr->type != RDT_SYN) {
-		cerr << "ERROR: Didn't get the expected RDT_SYN type.\n";
-		return false;
-	}
-	cerr << "Received RDT_SYN.\n";
-
-	// Send an RDT_SYNACK message to remote host to initiate an RDT connection.
-	char send_segment[MAX_SEG_SIZE];
-	char recv_segment[MAX_SEG_SIZE];
-	
-	hdr 					= (RDTHeader*)send_segment;
-	hdr->ack_number 		= htonl(0);
-	hdr->sequence_number 	= htonl(0);
-	hdr->type 				= RDT_SYNACK;
-	
-	// This call will fill out the recv_segment
-	cerr << "Sending RDT_SYNACK.\n";
-	bool result = true;
-	do
-	{
-		set_timeout_length(this->estimated_rtt + (4 * this->dev_rtt));
-		this->send_and_wait(send_segment, sizeof(RDTHeader), recv_segment);
-		cerr << "Sent RDT_SYNACK.\n";
-
-		// Check that segment was the right type of message, namely a RDT_ACK
-		// message to indicate that the remote host wants to start a new
-		// connection with us.
-		hdr 	= (RDTHeader*)recv_segment;
-		result 	= (hdr->type == RDT_ACK);
-
-		if (result) {
-			cerr << "Received RDT_ACK boi!\n";
-		} else {
-			cerr << "ERROR: Didn't get the expected RDT_ACK type. Trying again.\n";
-		}
-	} while (!result);
-	
+	this->receiver_handshake(hdr, recv_count);
 	return true;
 }
 
-bool ReliableSocket::send_and_wait(char send_segment[], int send_seg_size, char *recv_segment) {
-	int bytes_received = -1;
-	
-	do {
-		// Send the segment
-		int start_time = current_msec();
-		if (send(this->sock_fd, send_segment, send_seg_size, 0) < 0) {
-			perror("syn1 send");
-		}
-
-		// Get ready to receive the segment
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		// cerr << "Receiving...\n";
-		bytes_received = recv(this->sock_fd, recv_segment, MAX_SEG_SIZE, 0);
-	
-		if (bytes_received < 0 && errno != EAGAIN) { 
-			// Means some other error than timeouts
-			perror("ACK not received");
-			exit(EXIT_FAILURE);
-		}
-
-		// RTT calculated here; if timeout occured, then curr_rtt will get
-		// overwritten
-		this->curr_rtt = current_msec() - start_time;
-	} while (bytes_received < 0); // keeps going for timeouts; breaks when data is received
-
-	// Calculate the RTT and set the estimated value (based on the last rtt
-	// value	
-	this->set_estimated_rtt();
-	return true;
-}
+void ReliableSocket::receiver_handshake(const RDTHeader *syn, int length) {
+	RDT_LOG(RDT_LOG_INFO, "Received RDT_SYN.\n");
+	this->stats.add(RDTStatCounters::SEGMENTS_RECEIVED);
+	this->connection_id 	= ntohs(syn->connection_id);
+	this->echo_timestamp 	= ntohl(syn->timestamp);
 
-bool ReliableSocket::send_and_timeout(char send_segment[], int seg_size) {
-	bool keep_going = true;
-	char recv_segment[MAX_SEG_SIZE];
+	// Only send SACK blocks if the other side said it understands them
+	this->sack_enabled = (syn->flags & RDT_FLAG_SACK) != 0;
+	this->peer_checksums = (syn->flags & RDT_FLAG_CHECKSUM) != 0;
+	this->negotiate_segment_size(syn, length);
 
-	do {
-		if (send(this->sock_fd, send_segment, sizeof(RDTHeader), 0) < 0) {
-			// Not all data sent
-			cerr << "send() error\n";
-			continue;
-		}
-		cerr << "Segment sent. Timing out\n";
-		
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		this->set_timeout_length(this->estimated_rtt + (this->dev_rtt * 4));
-		if (recv(this->sock_fd, recv_segment, MAX_SEG_SIZE, 0) > 0) {
-			cerr << "Received Packet.\n";
-			keep_going = true;
-		} else {
-			// Timeout reached
-			keep_going = false;
-		}
-	} while (keep_going);
-	
-	return true;
+	// Send an RDT_SYNACK message to remote host to initiate an RDT connection.
+	// It is resent (from process_timeouts) until the ACK comes in.
+	RDT_LOG(RDT_LOG_INFO, "Sending RDT_SYNACK.\n");
+	this->send_control(RDT_SYNACK);
+	this->state 					= SYN_ACK;
+	this->retransmit_timer_start 	= current_usec();
+	this->control_transmissions 	= 1;
 }
 
 void ReliableSocket::connect_to_remote(char *hostname, int port_num) {
 	if (this->state != INIT) {
-		cerr << "Cannot call connect_to_remote on used socket\n";
+		RDT_LOG(RDT_LOG_ERROR, "Cannot call connect_to_remote on used socket\n");
 		return;
 	}
 	
@@ -225,63 +307,199 @@ void ReliableSocket::connect_to_remote(char *hostname, int port_num) {
 	 * This means we can then use send and recv instead of the more complex
 	 * sendto and recvfrom.
 	 */
-	if(connect(this->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+	if (this->transport->connect(&addr)) {
 		perror("connect");
 	}
 
-	// TODO: Again, you should implement a handshaking protocol for the
-	// connection setup.
-	// Note that this function is called by the connection initiator.
 	this->sender_handshake();
-	
-	this->state = ESTABLISHED;
-	cerr << "INFO: Connection ESTABLISHED\n";
+	if (this->nonblocking) {
+		this->io.flush_sends();
+		this->update_timer();
+		return;
+	}
+
+	while (this->state == SYN) {
+		this->wait_for_events();
+	}
 }
 
-bool ReliableSocket::sender_handshake() {
+void ReliableSocket::sender_handshake() {
+	// Pick an ID no earlier connection from this address is likely to have
+	// used (0 is left for "none")
+	this->connection_id = 1 + this->transport->random() % 0xffff;
+
 	// Send an RDT_SYN message to remote host to initiate an RDT connection.
-	char send_segment[MAX_SEG_SIZE];
-	char recv_segment[MAX_SEG_SIZE];
-	
-	RDTHeader* hdr 			= (RDTHeader*)send_segment;
-	hdr->ack_number 		= htonl(0);
-	hdr->sequence_number 	= htonl(0);
-	hdr->type 				= RDT_SYN;
-	
-	// Fill out the recv_segment
-	this->send_and_wait(send_segment, sizeof(RDTHeader), recv_segment);
-	cerr << "Sent the RDT_SYN.\n";
-	// Check that the segment was a SYNACK type
-	memset(hdr, 0, sizeof(RDTHeader));
-	hdr = (RDTHeader*)recv_segment;
-	if (hdr->type != RDT_SYNACK) {
-		// This was not a SYNACK response
-		perror("Message received was not a SYNACK");
-		return false;	
-	}
-
-	cerr << "Received RDT_SYNACK.\n";	
-	
-	// Send ACK
-	memset(send_segment, 0, sizeof(RDTHeader));
-	hdr 					= (RDTHeader*)send_segment;
-	hdr->ack_number 		= htonl(0);
+	// It is resent (from process_timeouts) until the SYNACK comes in.
+	this->send_control(RDT_SYN);
+	RDT_LOG(RDT_LOG_INFO, "Sent the RDT_SYN.\n");
+	this->state 					= SYN;
+	this->retransmit_timer_start 	= current_usec();
+	this->control_transmissions 	= 1;
+}
+
+void ReliableSocket::establish_connection(const RDTHeader *hdr) {
+	// The echoed timestamp says which SYN or SYNACK this answers, even if it
+	// was resent
+	int rtt_sample = this->sample_rtt(hdr);
+	if (rtt_sample >= 0) {
+		this->curr_rtt = rtt_sample;
+		this->set_estimated_rtt();
+	}
+
+	this->state = ESTABLISHED;
+	this->stats.mark_start(current_msec());
+	RDT_LOG(RDT_LOG_INFO, "INFO: Connection ESTABLISHED\n");
+
+	if (this->pmtu_probing) {
+		this->send_probe(this->probe_ceiling);
+	}
+}
+
+void ReliableSocket::negotiate_segment_size(const RDTHeader *hdr, int length) {
+	// Someone who doesn't say takes the default (and sends no repair segments)
+	int peer_max = DEFAULT_SEG_SIZE;
+	if ((hdr->flags & RDT_FLAG_MSS) 
+			&& length >= (int)(sizeof(RDTHeader) + sizeof(RDTSynOptions))) {
+		const RDTSynOptions *options = (const RDTSynOptions*)(hdr + 1);
+		peer_max 					= ntohl(options->max_segment_size);
+		this->peer_fec_block_size 	= ntohl(options->fec_block_size);
+		if (this->peer_fec_block_size > MAX_FEC_BLOCK_SIZE) {
+			this->peer_fec_block_size = 0;
+		}
+	}
+
+	int limit = (peer_max < this->max_seg_size) ? peer_max : this->max_seg_size;
+	this->seg_size_limit 	= (limit > MIN_SEG_SIZE) ? limit : MIN_SEG_SIZE;
+	this->seg_size 			= this->seg_size_limit;
+	this->measure_receive_buffer();
+
+	// Copies of our data, and the parity of FEC blocks, take up to a full
+	// segment's payload (and repair segments we send a header too). Nothing
+	// has been sent or received yet, so the pool is still empty.
+	this->segment_pool.reset(this->seg_size_limit);
+	this->fec_sent_buffers.clear();
+
+	// The first block's repair segment, as large as any data segment
+	if (this->fec_block_size > 0) {
+		this->fec_buffer_id = this->segment_pool.acquire();
+		memset(this->segment_pool.get(this->fec_buffer_id), 0, this->seg_size_limit);
+	}
+	if (!this->pmtu_probing) {
+		return;
+	}
+
+	// Probing starts from the default size. There's no point probing past
+	// what our own network interface can send without fragmenting (which
+	// the kernel can only tell us if the socket is connected).
+	if (this->seg_size > DEFAULT_SEG_SIZE) {
+		this->seg_size = DEFAULT_SEG_SIZE;
+	}
+	this->probe_ceiling = this->seg_size_limit;
+
+	int mtu;
+	socklen_t mtu_length = sizeof(mtu);
+	if (this->listener == NULL
+			&& this->transport->get_option(IPPROTO_IP, IP_MTU, &mtu, &mtu_length) == 0
+			&& mtu - IP_UDP_HEADER_SIZE < this->probe_ceiling) {
+		this->probe_ceiling = mtu - IP_UDP_HEADER_SIZE;
+	}
+}
+
+void ReliableSocket::send_control(RDTMessageType type, uint32_t ack_number) {
+	char segment[sizeof(RDTHeader) + sizeof(RDTSynOptions)];
+	static_assert(sizeof(segment) <= DatagramIO::MAX_COPY_SIZE, "control segments are sent as copies");
+	RDTHeader *hdr 			= (RDTHeader*)segment;
 	hdr->sequence_number 	= htonl(0);
-	hdr->type 				= RDT_ACK;
+	hdr->ack_number 		= htonl(ack_number);
+	hdr->type 				= type;
+	hdr->flags 				= (type == RDT_SYN && this->sack_enabled) ? RDT_FLAG_SACK : 0;
+	hdr->connection_id 		= htons(this->connection_id);
+	this->stamp_header(hdr);
 
-	// Send the segment
-	this->send_and_timeout(send_segment, sizeof(RDTHeader));
-	cerr << "ACK Sent.\n";
+	// Tell the other end the largest segment we take, and whether repair
+	// segments are coming
+	struct iovec options = { hdr + 1, 0 };
+	if (type == RDT_SYN || type == RDT_SYNACK) {
+		((RDTSynOptions*)(hdr + 1))->max_segment_size 	= htonl(this->max_seg_size);
+		((RDTSynOptions*)(hdr + 1))->fec_block_size 	= htonl(this->fec_block_size);
+		hdr->flags 			|= RDT_FLAG_MSS;
+		options.iov_len 	= sizeof(RDTSynOptions);
+		if (RDTChecksumPolicy::ENABLED) {
+			hdr->flags 		|= RDT_FLAG_CHECKSUM;
+		}
+	}
+	set_checksum(hdr, &options, 1);
 
-	return true;
+	this->io.queue_send_copy(segment, sizeof(RDTHeader) + options.iov_len);
+	this->stats.add(RDTStatCounters::SEGMENTS_SENT);
 }
 
-// You should not modify this function in any way.
 uint32_t ReliableSocket::get_estimated_rtt() {
+	return this->estimated_rtt / 1000;
+}
+
+uint32_t ReliableSocket::get_estimated_rtt_us() {
 	return this->estimated_rtt;
 }
 
+void ReliableSocket::set_min_timeout(uint32_t usec) {
+	this->min_timeout_us = usec;
+}
+
+int ReliableSocket::sample_rtt(const RDTHeader *hdr) {
+	uint32_t echo = ntohl(hdr->timestamp_echo);
+	if (echo == 0) {
+		return -1;
+	}
+
+	// Timestamps wrap around every 71 minutes, but the difference is still
+	// right (and anything "negative" is garbage)
+	int32_t rtt = (uint32_t)current_usec() - echo;
+	return (rtt >= 0) ? rtt : -1;
+}
+
+void ReliableSocket::stamp_header(RDTHeader *hdr) {
+	// 0 means "no timestamp", so skip it when the clock wraps around to it
+	uint32_t now 		= current_usec();
+	hdr->timestamp 		= htonl((now != 0) ? now : 1);
+	hdr->timestamp_echo = htonl(this->echo_timestamp);
+
+	uint32_t window 				= this->receive_window();
+	hdr->window 					= htonl(window);
+	this->advertised_window_edge 	= this->expected_sequence_number + window;
+}
+
+void ReliableSocket::set_checksum(RDTHeader *hdr, const struct iovec *payload, int iovcnt) {
+	hdr->checksum = htonl(RDTChecksumPolicy::compute(hdr, offsetof(RDTHeader, checksum), 
+													 payload, iovcnt));
+}
+
+bool ReliableSocket::checksum_ok(const char *segment, int length, bool peer_checksums) {
+	// Built without checksums, we don't check any
+	if (!RDTChecksumPolicy::ENABLED) {
+		return true;
+	}
+
+	// A SYN or SYNACK says for itself whether its sender checksums
+	const RDTHeader *hdr = (const RDTHeader*)segment;
+	if ((hdr->type == RDT_SYN || hdr->type == RDT_SYNACK) && (hdr->flags & RDT_FLAG_CHECKSUM)) {
+		peer_checksums = true;
+	}
+	if (!peer_checksums) {
+		return true;
+	} else if (hdr->checksum == 0) {
+		return false;
+	}
+
+	struct iovec payload = { (void*)(segment + sizeof(RDTHeader)), length - sizeof(RDTHeader) };
+	uint32_t sum = RDTChecksumPolicy::compute(segment, offsetof(RDTHeader, checksum), 
+											  &payload, 1);
+	return sum == ntohl(hdr->checksum);
+}
+
 void ReliableSocket::set_estimated_rtt(){
+	this->stats.record_rtt(this->curr_rtt);
+
 	// Caculate the RTT
 	this->estimated_rtt *= 0.5;	
 	this->estimated_rtt += this->curr_rtt * 0.5;	
@@ -294,308 +512,1509 @@ void ReliableSocket::set_estimated_rtt(){
 
 	this->dev_rtt += (0.5 * abs_value);
 	
-	//cerr << "EST_RTT: " << this->estimated_rtt << "\n";
-	//cerr << "DEV_RTT: " << this->dev_rtt << "\n";
+	RDT_LOG(RDT_LOG_TRACE, "EST_RTT: " << this->estimated_rtt 
+			<< ", DEV_RTT: " << this->dev_rtt << "\n");
+}
+
+void ReliableSocket::set_window_size(uint32_t num_segments) {
+	this->window_size = (num_segments > 0) ? num_segments : 1;
+}
+
+RDTIOStats ReliableSocket::get_io_stats() {
+	RDTIOStats stats = this->io.get_stats();
+	stats.heap_allocations += this->segment_pool.get_allocations()
+							  + this->unacked_segments.get_allocations()
+							  + this->reassembly_buffer.get_allocations()
+							  + this->fec_blocks.get_allocations();
+	return stats;
+}
+
+RDTStats ReliableSocket::get_stats() {
+	return this->stats.snapshot();
+}
+
+bool ReliableSocket::set_offload_enabled(bool enabled) {
+	if (this->state != INIT) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Offload can only be changed before connecting.\n");
+		return false;
+	}
+
+	return this->io.set_offload(enabled);
+}
+
+void ReliableSocket::set_sack_enabled(bool enabled) {
+	this->sack_enabled = enabled;
+}
+
+void ReliableSocket::set_dup_ack_threshold(uint32_t num_dup_acks) {
+	this->dup_ack_threshold = num_dup_acks;
+}
+
+void ReliableSocket::set_max_segment_size(int bytes) {
+	if (this->state != INIT) {
+		RDT_LOG(RDT_LOG_ERROR, "Cannot change the segment size of a used socket\n");
+		return;
+	}
 
-	this->set_timeout_length(this->estimated_rtt + 4 * this->dev_rtt);
+	if (bytes < MIN_SEG_SIZE) {
+		bytes = MIN_SEG_SIZE;
+	} else if (bytes > MAX_SEG_SIZE) {
+		bytes = MAX_SEG_SIZE;
+	}
+	this->max_seg_size = bytes;
+	this->io.set_max_datagram_size(bytes);
 }
 
-// You shouldn't need to modify this function in any way.
-void ReliableSocket::set_timeout_length(uint32_t timeout_length_ms) {
-	cerr << "INFO: Setting timeout to " << timeout_length_ms << " ms\n";
-	struct timeval timeout;
-	msec_to_timeval(timeout_length_ms, &timeout);
+int ReliableSocket::get_segment_size() {
+	return this->seg_size;
+}
 
-	if (setsockopt(this->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
-					sizeof(struct timeval)) < 0) {
+void ReliableSocket::set_pmtu_probing(bool enabled) {
+	// Probes must be dropped (not fragmented) if they're too big for the path
+	int discover = enabled ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT;
+	if (this->transport->set_option(IPPROTO_IP, IP_MTU_DISCOVER, 
+									&discover, sizeof(discover)) < 0) {
 		perror("setsockopt");
-		exit(EXIT_FAILURE);
+		return;
 	}
+	this->pmtu_probing = enabled;
 }
 
-void ReliableSocket::send_data(const void *data, int length) {
-	if (this->state != ESTABLISHED) {
-		cerr << "INFO: Cannot send: Connection not established.\n";
+void ReliableSocket::set_fec_block_size(uint32_t num_segments) {
+	if (this->state != INIT) {
+		RDT_LOG(RDT_LOG_ERROR, "Cannot change the FEC block size of a used socket\n");
 		return;
 	}
 
- 	// Create the segment, which contains a header followed by the data.
-	char send_segment[MAX_SEG_SIZE];
-	char recv_segment[MAX_SEG_SIZE];
+	if (num_segments > MAX_FEC_BLOCK_SIZE) {
+		num_segments = MAX_FEC_BLOCK_SIZE;
+	}
+	this->fec_block_size = num_segments;
+}
 
-	// Fill in the header
-	RDTHeader *hdr 			= (RDTHeader*)send_segment;
-	hdr->sequence_number 	= htonl(this->sequence_number);
-	hdr->ack_number 		= htonl(0);
-	hdr->type 				= RDT_DATA;
+void ReliableSocket::set_congestion_control(RDTCongestionAlgorithm algorithm) {
+	if (!this->congestion_control.select(algorithm)) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: The congestion controller was picked when building.\n");
+	}
+}
 
-	// Copy the user-supplied data to the spot right past the 
-	// 	header (i.e. hdr+1).
-	memcpy(hdr + 1, data, length);
-	
-	// TODO: This assumes a reliable network. You'll need to add code that
-	// waits for an acknowledgment of the data you just sent, and keeps
-	// resending until that ack comes.
-	// Utilize the set_timeout_length function to make sure you timeout after
-	// a certain amount of waiting (so you can try sending again).
-	
-	bool keep_going = true;
-	do {
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		cerr << "Sending Sequence Number: #" << this->sequence_number << ".\n";
-		send_and_wait(send_segment, sizeof(RDTHeader) + length, recv_segment);
-
-		hdr = (RDTHeader*)recv_segment;
-		if (hdr->type == RDT_ACK) {
-			if (ntohl(hdr->ack_number) == this->sequence_number) {
-				// Correct ACK Received
-				keep_going = false;
-			} else {
-				// Out of Order ACK
-				cerr << "Out of order ACK: " << ntohl(hdr->ack_number) << ". Supposed to be: " << this->sequence_number << ".\n";
-			}
-		} else {
-			cerr << "Received segment was not an ACK." << hdr->type << "\n";
-			keep_going = true;
-			/*
-			memset(send_segment, 0, MAX_SEG_SIZE);
-			RDTHeader *hdr 			= (RDTHeader*)send_segment;
-			hdr->sequence_number 	= htonl(this->sequence_number);
-			hdr->ack_number 		= htonl(0);
-			hdr->type 				= RDT_DATA;
-			*/
-		}
-	}
-	while (keep_going);
-	cerr << "Received ACK Number: #" << ntohl(hdr->ack_number) << ".\n";
-	
-	this->sequence_number++;
+void ReliableSocket::set_nonblocking(bool enabled) {
+	if (this->listener != NULL) {
+		// The listener's socket is set up for all of its connections
+		this->nonblocking = enabled;
+		return;
+	}
+
+	if (this->transport->set_nonblocking(enabled) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+	}
+	this->nonblocking = enabled;
+}
+
+uint32_t ReliableSocket::retransmit_timeout() {
+	uint32_t timeout = this->estimated_rtt + (4 * this->dev_rtt);
+	return (timeout < this->min_timeout_us) ? this->min_timeout_us : timeout;
 }
 
+uint32_t ReliableSocket::send_window() {
+	uint32_t cwnd = this->congestion_control->get_window();
+	if (cwnd < UINT32_MAX - this->recovery_inflation) {
+		cwnd += this->recovery_inflation;
+	}
+	uint32_t window = (cwnd < this->window_size) ? cwnd : this->window_size;
+	if (RDTArqPolicy::MAX_WINDOW > 0 && window > RDTArqPolicy::MAX_WINDOW) {
+		window = RDTArqPolicy::MAX_WINDOW;
+	}
 
-int ReliableSocket::receive_data(char buffer[MAX_DATA_SIZE]) {
-	int recv_count = 0;
-	bool keep_going = true;
-	while (keep_going) {
-		cerr << "RECV\n";
-		keep_going = false;
-		if (this->state != ESTABLISHED) {
-			cerr << "INFO: Cannot receive: Connection not established.\n";
+	// ... and no further than the receiver has room for
+	uint32_t first = this->unacked_segments.empty() ? this->sequence_number 
+						: this->unacked_segments.first();
+	int32_t room = this->peer_window_edge - first;
+	if (room < (int32_t)window) {
+		window = (room > 0) ? room : 0;
+	}
+	return window;
+}
+
+int ReliableSocket::send_data(const void *data, int length) {
+	if (this->state != ESTABLISHED || this->close_pending) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Cannot send: Connection not established.\n");
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	// We return before this is acknowledged, so the segments get their own
+	// copies of the data
+	struct iovec buffer;
+	buffer.iov_base = (void*)data;
+	buffer.iov_len 	= (length > 0) ? length : 0;
+	int queued = this->queue_segments(&buffer, 1, true);
+
+	if (this->nonblocking) {
+		// Nobody is going to wait for ACKs (and send the batch) for us
+		this->io.flush_sends();
+		this->update_timer();
+		if (queued == 0 && length > 0) {
+			errno = EAGAIN;
 			return -1;
 		}
-	
-		char received_segment[MAX_SEG_SIZE];
-		char send_segment[sizeof(RDTHeader)];
-		memset(received_segment, 0, MAX_SEG_SIZE);
-	
-		// Set up pointers to both the header (hdr) and data (data) portions of
-		// the received segment.
-		RDTHeader* hdr = (RDTHeader*)received_segment;	
-		void *data = (void*)(received_segment + sizeof(RDTHeader));
-	
-		// receive the data and check for timeouts/errors
-		this->set_timeout_length(this->estimated_rtt + (this->dev_rtt * 4));
-		recv_count = recv(this->sock_fd, received_segment, MAX_SEG_SIZE, 0);
-		if (recv_count < 0 && errno != EAGAIN) {
-			perror("receive_data recv");
-			exit(EXIT_FAILURE);
-		} else if (recv_count < 0 && errno == EAGAIN) {
-			// Timeout
-				cerr << "recv timed out.\n";
-			
-			keep_going = true;
-			continue;
-		}
-	
-		// TODO: You should send back some sort of acknowledment that you
-		// received some data, but first you'll need to make sure that what you
-		// received is the type you want (RDT_DATA) and has the right sequence
-			// number.
-	
-		cerr << "INFO: Received segment. " 
-			 << "seq_num = "<< ntohl(hdr->sequence_number) << ", "
-			 << "ack_num = "<< ntohl(hdr->ack_number) << ", "
-				 << ", type = " << hdr->type << "\n";
-	
-		uint32_t received_seq_num = hdr->sequence_number;	
-		cerr << "Actual Sequence number is #" << this->sequence_number << "\n";
-		cerr << "Received Sequence number is #" << ntohl(received_seq_num) << "\n";
-		
-		if (hdr->type == RDT_FIN) {
-			// Sender trying to finish the conversation
-			cerr << "Received FIN.\n";
-			hdr 					= (RDTHeader*)send_segment;
-			hdr->sequence_number 	= htonl(0);
-			hdr->ack_number 		= htonl(0);
-			hdr->type 				= RDT_FINACK;
-			
-			// Send the FINACK
-			this->send_and_timeout(send_segment, sizeof(RDTHeader));
-			cerr << "FINACK Sent.\n";
-			
-			this->state = FIN_STATE;
-			return 0;
-		} else {
-			// No matter what, we ack the data that we just received
-			hdr 					= (RDTHeader*)send_segment;
-			hdr->ack_number 		= received_seq_num;
-			hdr->sequence_number 	= received_seq_num;
-			hdr->type 				= RDT_ACK;
-		
-			// Send the Ack
-			do {
-				cerr << "Sending ACK.\n";
-			} while (send(this->sock_fd, send_segment, sizeof(RDTHeader), 0) < 0);
-			cerr << "ACKed segment number #" << ntohl(hdr->sequence_number) << "\n";
-			
-			if (ntohl(received_seq_num) == this->sequence_number) {
-				// Sequence number was as expected so we can fill the buffer
-				// pointer
-				++this->sequence_number;
-				memcpy(buffer, data, recv_count - sizeof(RDTHeader));
-			} else {
-				// Sequence number failed so clear the data
-				cerr << "\nOut of order data packet.\n\n";
-				keep_going = true;
-			}	
-		}
-	}
-
-	return recv_count - sizeof(RDTHeader);
+	}
+	return queued;
 }
 
+void ReliableSocket::send_data(const struct iovec *iov, int iovcnt) {
+	if (this->state != ESTABLISHED || this->close_pending) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Cannot send: Connection not established.\n");
+		return;
+	} else if (this->nonblocking) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Cannot send: Borrowed buffers need a blocking socket.\n");
+		return;
+	}
 
-void ReliableSocket::close_connection() {
-	// Construct a RDT_CLOSE message to indicate to the remote host that we
-	// want to end this connection.
-	char send_segment[sizeof(RDTHeader)];
-	
-	RDTHeader* hdr 			= (RDTHeader*)send_segment;
-	hdr->sequence_number 	= htonl(0);
-	hdr->ack_number 		= htonl(0);
-	hdr->type 				= RDT_FIN;
+	this->queue_segments(iov, iovcnt, false);
 
-	if (this->state == FIN_STATE) {
-		cerr << "Receiver.\n";
-		this->receiver_close_handshake();	
-	} else {
-		cerr << "Sender.\n";
-		this->sender_close_handshake();
+	// The segments point into the caller's buffers, so everything has to be
+	// acknowledged before we can give them back.
+	this->flush_send_window();
+}
+
+int64_t ReliableSocket::send_file(int fd) {
+	if (this->state != ESTABLISHED || this->close_pending) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Cannot send: Connection not established.\n");
+		errno = ENOTCONN;
+		return -1;
+	} else if (this->nonblocking) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Cannot send: Files need a blocking socket.\n");
+		errno = EINVAL;
+		return -1;
 	}
-	
-	// At this point we received stuff from sending the correct header type
-	// Now we need to check what we are getting back and see if we can finish
 
-	// TODO: As with creating a connection, you need to add some reliability
-	// into closing the connection to make sure both sides know that the
-	// connection has been closed.
-	
+	// Only regular files can be mapped (and some, e.g. in /proc, claim to
+	// be empty whatever they hold)
+	struct stat info;
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	if (fstat(fd, &info) < 0) {
+		return -1;
+	} else if (!S_ISREG(info.st_mode) || offset < 0 || info.st_size == 0) {
+		return this->send_file_chunks(fd);
+	} else if (offset >= info.st_size) {
+		return 0;
+	}
 
-	// For connection teardown here, we need to send FIN signal, as well as ACK
-	// that fin signal on the receiver side as well as sending own FIN to
-	// finally ACK that on the initator side
-	
-	// Probably need to make this a function
-	this->state = CLOSED;
-	if (close(this->sock_fd) < 0) {
-		perror("close_connection close");
+	// The mapping has to start on a page boundary
+	off_t map_start 	= offset - offset % sysconf(_SC_PAGESIZE);
+	size_t map_length 	= info.st_size - map_start;
+	char *map = (char*)mmap(NULL, map_length, PROT_READ, MAP_PRIVATE, fd, map_start);
+	if (map == MAP_FAILED) {
+		return this->send_file_chunks(fd);
 	}
-}
+	madvise(map, map_length, MADV_SEQUENTIAL);
 
-void ReliableSocket::sender_close_handshake() {
+	// Queue it a chunk at a time (queue_segments counts in ints), without
+	// waiting for one chunk to be acknowledged before starting on the next
+	int64_t total = 0;
+	size_t position = offset - map_start;
+	while (position < map_length) {
+		struct iovec chunk;
+		chunk.iov_base 	= map + position;
+		chunk.iov_len 	= map_length - position;
+		if (chunk.iov_len > FILE_MAP_CHUNK_SIZE) {
+			chunk.iov_len = FILE_MAP_CHUNK_SIZE;
+		}
 
-	// This function is just like the sender handshake but for closing the
-	// connection
-	char send_segment[MAX_SEG_SIZE];
-	char recv_segment[MAX_SEG_SIZE];
-	
-	RDTHeader* hdr 			= (RDTHeader*)send_segment;
-	hdr->ack_number 		= htonl(0);
-	hdr->sequence_number 	= htonl(0);
-	hdr->type 				= RDT_FIN;
-	
-	do
-	{
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		this->send_and_wait(send_segment, sizeof(RDTHeader), recv_segment);
-		cerr << "Sent the RDT_FIN.\n";
-	
-		// Check that the segment was a FINACK type
-		hdr = (RDTHeader*)recv_segment;
-	} while (hdr->type != RDT_FINACK);
+		int queued = this->queue_segments(&chunk, 1, false);
+		total 		+= queued;
+		position 	+= queued;
+		if ((size_t)queued < chunk.iov_len) {
+			// The connection went away
+			break;
+		}
+	}
 
-	cerr << "Received RDT_FINACK.\n";	
-	this->state = FIN_STATE;
-	
-	cerr << "Waiting for FIN.\n";
-	int recv_count = 0;
-	do
-	{
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		recv_count = recv(this->sock_fd, recv_segment, MAX_SEG_SIZE, 0);
-		if (recv_count < 0) {
-			// Timeout, keep waiting
+	// The segments point into the mapping, so everything has to be
+	// acknowledged before it can go.
+	this->flush_send_window();
+	munmap(map, map_length);
+	lseek(fd, offset + total, SEEK_SET);
+	return total;
+}
+
+int64_t ReliableSocket::send_file_chunks(int fd) {
+	std::vector<char> chunk(FILE_READ_CHUNK_SIZE);
+	int64_t total = 0;
+	while (true) {
+		ssize_t length = read(fd, chunk.data(), chunk.size());
+		if (length < 0 && errno == EINTR) {
 			continue;
-		} else if (recv_count < 0 && errno != EAGAIN) {
-			// Something other than timeout
-			perror("Waiting for FIN error");
-			exit(EXIT_FAILURE);
+		} else if (length <= 0) {
+			return (length < 0) ? -1 : total;
 		}
 
-		hdr = (RDTHeader*)recv_segment;
-	} while (hdr->type != RDT_FIN);
+		if (this->send_data(chunk.data(), length) < 0) {
+			return -1;
+		}
+		total += length;
+	}
+}
 
-	cerr << "Received FIN.\n";
+int ReliableSocket::queue_segments(const struct iovec *iov, int iovcnt, bool copy) {
+	// Cut the buffers into segments of (at most) seg_size bytes, each made
+	// up of the pieces of the buffers that it covers. With path MTU probing,
+	// seg_size may grow while we wait for room in the window.
+	struct iovec payload[MAX_PAYLOAD_IOVS];
+	int num_pieces 	= 0;
+	int seg_length 	= 0;
+	int queued 		= 0;
+	for (int i = 0; i < iovcnt; i++) {
+		char *base 	= (char*)iov[i].iov_base;
+		size_t left = iov[i].iov_len;
+		while (left > 0) {
+			int max_length 	= this->seg_size - sizeof(RDTHeader);
+			size_t piece 	= (seg_length < max_length) ? max_length - seg_length : 0;
+			if (piece > left) {
+				piece = left;
+			}
 
-	// Send FINACK and enter time_wait state for a little bit before closing
-	hdr = (RDTHeader*)send_segment;
-	hdr->type = RDT_FINACK;
-	
-	cerr << "Sending FINACK.\n";
-	bool keep_going = false;
-	do {
-		if (send(this->sock_fd, send_segment, sizeof(RDTHeader), 0) < 0) {
-			keep_going = true;
-			continue;
-		}
-		cerr << "Sent FINACK. Timing out\n";
-		
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		this->set_timeout_length(500);
-		if (recv(this->sock_fd, recv_segment, MAX_SEG_SIZE, 0) > 0) {
-			cerr << "Received Packet.\n";
-			hdr = (RDTHeader*)recv_segment;
-			if (hdr->type == RDT_FIN) {
-				cerr << "FINACK lost. Sending FINACK again.\n";
-				keep_going = true;
+			payload[num_pieces].iov_base 	= base;
+			payload[num_pieces].iov_len 	= piece;
+			num_pieces++;
+			seg_length 	+= piece;
+			base 		+= piece;
+			left 		-= piece;
+
+			if (seg_length >= max_length || num_pieces == MAX_PAYLOAD_IOVS) {
+				if (!this->queue_new_segment(payload, num_pieces, copy)) {
+					return queued;
+				}
+				queued 		+= seg_length;
+				num_pieces 	= 0;
+				seg_length 	= 0;
 			}
-		} else {
-			cerr << "Timed out.\n";
-			keep_going = false;
 		}
-	} while (keep_going == true);
-	cerr << "Sent FINACK. Timeout complete.\n";
+	}
+	if (num_pieces > 0 && this->queue_new_segment(payload, num_pieces, copy)) {
+		queued += seg_length;
+	}
+
+	return queued;
 }
 
-void ReliableSocket::receiver_close_handshake() {
-	
-	// This function is just like the sender handshake but for closing the
-	// connection
-	char send_segment[MAX_SEG_SIZE];
-	char recv_segment[MAX_SEG_SIZE];
-	
-	RDTHeader* hdr 			= (RDTHeader*)send_segment;
-	hdr->ack_number 		= htonl(0);
+bool ReliableSocket::queue_new_segment(const struct iovec *payload, int iovcnt, bool copy) {
+	// Make room in the send window before adding another segment to it.
+	while (this->unacked_segments.size() >= this->send_window()) {
+		this->send_stalled = true;
+		if (this->nonblocking || this->state != ESTABLISHED) {
+			return false;
+		}
+		this->wait_for_events();
+	}
+	this->send_stalled = false;
+
+ 	// Create the segment. It lives in the retransmission queue until it has
+	// been acknowledged. Making the queue bigger moves its segments, so the
+	// ones queued to be sent (which point at their headers) go out first.
+	if (!this->unacked_segments.fits(this->sequence_number)) {
+		this->io.flush_sends();
+	}
+	RDTSentSegment &sent = this->unacked_segments.insert(this->sequence_number);
+
+	// Fill in the header
+	RDTHeader *hdr 			= &sent.header;
+	hdr->sequence_number 	= htonl(this->sequence_number);
+	hdr->ack_number 		= htonl(0);
+	hdr->type 				= RDT_DATA;
+	hdr->flags 				= 0;
+	hdr->connection_id 		= htons(this->connection_id);
+
+	int length = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		length += payload[i].iov_len;
+	}
+	this->stats.add(RDTStatCounters::BYTES_IN_FLIGHT, length);
+
+	// It may have been cut to a size we fell back from while we waited for
+	// room (see fall_back_segment_size), so it has to be let through in
+	// fragments like the others of that size
+	if (this->pmtu_probing && length + (int)sizeof(RDTHeader) > this->seg_size) {
+		if (!this->fragmenting) {
+			this->probe_size = 0;
+			this->set_fragmenting(true);
+		}
+		this->fragment_until = this->sequence_number + 1;
+	}
+
+	if (copy) {
+		// Gather the user-supplied data into a buffer of our own
+		sent.buffer_id 	= this->segment_pool.acquire();
+		char *data 		= this->segment_pool.get(sent.buffer_id);
+		for (int i = 0, offset = 0; i < iovcnt; i++) {
+			memcpy(data + offset, payload[i].iov_base, payload[i].iov_len);
+			offset += payload[i].iov_len;
+		}
+		sent.payload[0].iov_base 	= data;
+		sent.payload[0].iov_len 	= length;
+		sent.payload_iovcnt 		= 1;
+	} else {
+		sent.buffer_id = -1;
+		for (int i = 0; i < iovcnt; i++) {
+			sent.payload[i] = payload[i];
+		}
+		sent.payload_iovcnt = iovcnt;
+	}
+
+	if (this->fec_block_size > 0) {
+		// Fold the data into the block's repair segment
+		char *parity = this->segment_pool.get(this->fec_buffer_id) + sizeof(RDTHeader);
+		for (int i = 0; i < iovcnt; i++) {
+			xor_into(parity, (const char*)payload[i].iov_base, payload[i].iov_len);
+			parity += payload[i].iov_len;
+		}
+		this->fec_length 		= (length > this->fec_length) ? length : this->fec_length;
+		this->fec_length_xor 	^= length;
+	}
+
+	// This goes out with the next batch (at the latest when we wait for ACKs)
+	RDT_LOG(RDT_LOG_TRACE, "Sending Sequence Number: #" << this->sequence_number << ".\n");
+	this->queue_segment(sent);
+	sent.last_sent 		= current_usec();
+	sent.transmissions 	= 1;
+	sent.sacked 		= false;
+
+	if (this->unacked_segments.size() == 1) {
+		// First segment in flight, so the retransmission timer starts now
+		this->retransmit_timer_start = sent.last_sent;
+	}
+
+	this->sequence_number++;
+	if (this->fec_block_size > 0 && this->sequence_number % this->fec_block_size == 0) {
+		this->send_fec();
+	}
+	return true;
+}
+
+void ReliableSocket::send_fec() {
+	uint32_t num_segments 	= (this->sequence_number - 1) % this->fec_block_size + 1;
+	RDTHeader *hdr 			= (RDTHeader*)this->segment_pool.get(this->fec_buffer_id);
+	hdr->sequence_number 	= htonl(this->sequence_number - num_segments);
+	hdr->ack_number 		= htonl(num_segments << 16 | this->fec_length_xor);
+	hdr->type 				= RDT_FEC;
+	hdr->flags 				= 0;
+	hdr->connection_id 		= htons(this->connection_id);
+	this->stamp_header(hdr);
+
+	struct iovec parity = { hdr + 1, (size_t)this->fec_length };
+	set_checksum(hdr, &parity, 1);
+
+	// It is never resent, so its buffer is only kept until it has gone out,
+	// and the next block starts in a fresh one right away
+	this->io.queue_send(hdr, sizeof(RDTHeader) + this->fec_length);
+	this->stats.add(RDTStatCounters::SEGMENTS_SENT);
+	this->stats.add(RDTStatCounters::FEC_SEGMENTS_SENT);
+
+	this->fec_sent_buffers.push_back(this->fec_buffer_id);
+	this->fec_buffer_id = this->segment_pool.acquire();
+	memset(this->segment_pool.get(this->fec_buffer_id), 0, this->seg_size_limit);
+	this->fec_length 		= 0;
+	this->fec_length_xor 	= 0;
+}
+
+void ReliableSocket::queue_segment(RDTSentSegment &sent) {
+	this->stamp_header(&sent.header);
+
+	struct iovec iov[1 + MAX_PAYLOAD_IOVS];
+	iov[0].iov_base = &sent.header;
+	iov[0].iov_len 	= sizeof(RDTHeader);
+	for (int i = 0; i < sent.payload_iovcnt; i++) {
+		iov[i + 1] = sent.payload[i];
+	}
+	set_checksum(&sent.header, sent.payload, sent.payload_iovcnt);
+
+	this->io.queue_send(iov, 1 + sent.payload_iovcnt);
+	this->stats.add(RDTStatCounters::SEGMENTS_SENT);
+}
+
+void ReliableSocket::wait_for_events() {
+	// Segments for us arrive on the listener's socket, along with those of
+	// its other connections, which it looks after at the same time
+	if (this->listener != NULL) {
+		this->listener->wait_for_events(this);
+		return;
+	}
+
+	// Everything we've queued has to go out before we block
+	this->io.flush_sends();
+
+	// Only wait until the next timer runs out (or forever if none is running)
+	int64_t time_left = this->next_timeout();
+	if (time_left == 0) {
+		this->process_timeouts();
+		return;
+	}
+
+	this->io.set_receive_timeout((time_left < 0) ? -1 : (time_left + 999) / 1000);
+	if (this->state == LISTEN) {
+		this->listen_for_syn();
+	} else {
+		this->receive_segments();
+	}
+
+	this->process_timeouts();
+	this->io.flush_sends();
+}
+
+bool ReliableSocket::receive_segments() {
+	char *recv_segment;
+	int buffer_id;
+	int recv_count = this->io.receive(&recv_segment, &buffer_id);
+	if (recv_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK 
+			&& errno != EINTR && errno != ECONNREFUSED) {
+		perror("receive_segments recv");
+		exit(EXIT_FAILURE);
+	} else if (recv_count < 0) {
+		// Timeout (or an ICMP error because the other end isn't there yet)
+		return false;
+	}
+	this->process_segment(recv_segment, recv_count, buffer_id);
+
+	// Handle the rest of the batch without blocking again
+	while (this->io.has_pending_receive() && this->state != CLOSED) {
+		recv_count = this->io.receive(&recv_segment, &buffer_id);
+		this->process_segment(recv_segment, recv_count, buffer_id);
+	}
+
+	return true;
+}
+
+void ReliableSocket::process_segment(char *segment, int length, int buffer_id) {
+	RDTHeader *hdr = (RDTHeader*)segment;
+	if (length < (int)sizeof(RDTHeader)) {
+		RDT_LOG(RDT_LOG_DEBUG, "Received segment was too short.\n");
+		return;
+	} else if (!checksum_ok(segment, length, this->peer_checksums)) {
+		RDT_LOG(RDT_LOG_DEBUG, "Received segment was corrupted.\n");
+		this->stats.add(RDTStatCounters::CORRUPT_SEGMENTS);
+		return;
+	} else if (ntohs(hdr->connection_id) != this->connection_id) {
+		RDT_LOG(RDT_LOG_DEBUG, "Received segment from another connection.\n");
+		return;
+	}
+	this->stats.add(RDTStatCounters::SEGMENTS_RECEIVED);
+	this->echo_timestamp = ntohl(hdr->timestamp);
+
+	switch (hdr->type) {
+	case RDT_SYN:
+		if (this->state == SYN_ACK) {
+			RDT_LOG(RDT_LOG_INFO, "SYNACK lost. Sending RDT_SYNACK again.\n");
+			this->send_control(RDT_SYNACK);
+		}
+		break;
+
+	case RDT_SYNACK:
+		if (this->state == SYN) {
+			RDT_LOG(RDT_LOG_INFO, "Received RDT_SYNACK.\n");
+			this->peer_checksums = (hdr->flags & RDT_FLAG_CHECKSUM) != 0;
+			this->negotiate_segment_size(hdr, length);
+			this->update_peer_window(hdr);
+			this->establish_connection(hdr);
+		} else if (this->state != ESTABLISHED) {
+			break;
+		}
+
+		// Send ACK (again, if the SYNACK was resent because ours got lost)
+		this->send_control(RDT_ACK);
+		RDT_LOG(RDT_LOG_INFO, "ACK Sent.\n");
+		break;
+
+	case RDT_ACK:
+		if (this->state == SYN_ACK) {
+			RDT_LOG(RDT_LOG_INFO, "Received RDT_ACK boi!\n");
+			this->establish_connection(hdr);
+		} else {
+			// Even with nothing in flight, this may be a window update
+			bool window_moved = this->update_peer_window(hdr);
+			if (this->unacked_segments.empty()) {
+				break;
+			}
+
+			this->process_ack(segment, length, window_moved);
+			if (this->close_pending && this->unacked_segments.empty()) {
+				this->close_pending = false;
+				this->start_close();
+			}
+		}
+		break;
+
+	case RDT_DATA:
+		if (this->state == SYN_ACK) {
+			// Our SYNACK got through and the ACK for it got lost
+			this->establish_connection(hdr);
+		}
+		if (this->state == ESTABLISHED || this->state == FIN_STATE) {
+			RDTRecvView data = { segment + sizeof(RDTHeader), 
+								 (int)(length - sizeof(RDTHeader)), buffer_id };
+			this->process_data(hdr, data);
+		}
+		break;
+
+	case RDT_FEC:
+		// Only worth an ACK if it stood in for a lost segment
+		if (this->state == ESTABLISHED 
+				&& this->fec_add_repair(hdr, segment + sizeof(RDTHeader), 
+										length - sizeof(RDTHeader))) {
+			this->send_ack(ntohl(hdr->sequence_number));
+		}
+		break;
+
+	case RDT_FIN:
+		this->process_fin();
+		break;
+
+	case RDT_PROBE:
+		// Tell the other end a segment this size got through
+		this->send_control(RDT_PROBEACK, length);
+		break;
+
+	case RDT_PROBEACK:
+		this->handle_probe_ack(ntohl(hdr->ack_number));
+		break;
+
+	case RDT_WINDOW_PROBE:
+		if (this->state == ESTABLISHED) {
+			this->send_ack(this->expected_sequence_number);
+		}
+		break;
+
+	case RDT_FINACK:
+		if (this->state == RECV_ACK) {
+			RDT_LOG(RDT_LOG_INFO, "Received RDT_FINACK.\n");
+			RDT_LOG(RDT_LOG_INFO, "Waiting for FIN.\n");
+			this->state = RECV_FIN;
+		} else if (this->state == LAST_ACK) {
+			RDT_LOG(RDT_LOG_INFO, "Received FINACK. Connection Closed.\n");
+			this->finish_close();
+		}
+		break;
+
+	default:
+		RDT_LOG(RDT_LOG_DEBUG, "Received segment of unknown type " << hdr->type << ".\n");
+		break;
+	}
+}
+
+void ReliableSocket::process_fin() {
+	switch (this->state) {
+	case ESTABLISHED:
+		// Sender trying to finish the conversation. It only does that once
+		// all of its data has been ACKed, so there's nothing more coming.
+		RDT_LOG(RDT_LOG_INFO, "Received FIN.\n");
+		this->stats.mark_end(current_msec());
+		this->send_control(RDT_FINACK);
+		RDT_LOG(RDT_LOG_INFO, "FINACK Sent.\n");
+		this->state = FIN_STATE;
+		break;
+
+	case FIN_STATE:
+	case LAST_ACK:
+		RDT_LOG(RDT_LOG_INFO, "FINACK lost. Sending FINACK again.\n");
+		this->send_control(RDT_FINACK);
+		break;
+
+	case RECV_ACK:
+	case RECV_FIN:
+		// Send FINACK and enter time_wait state for a little bit before
+		// closing (a FIN here also tells us our own FIN got through)
+		RDT_LOG(RDT_LOG_INFO, "Received FIN.\n");
+		RDT_LOG(RDT_LOG_INFO, "Sending FINACK.\n");
+		this->send_control(RDT_FINACK);
+		this->state 					= SEND_ACK;
+		this->retransmit_timer_start 	= current_usec();
+		break;
+
+	case SEND_ACK:
+		RDT_LOG(RDT_LOG_INFO, "FINACK lost. Sending FINACK again.\n");
+		this->send_control(RDT_FINACK);
+		this->retransmit_timer_start = current_usec();
+		break;
+
+	default:
+		break;
+	}
+}
+
+void ReliableSocket::process_timeouts() {
+	uint64_t elapsed = current_usec() - this->retransmit_timer_start;
+	switch (this->state) {
+	case SYN:
+	case SYN_ACK:
+	case RECV_ACK:
+	case LAST_ACK:
+		if (elapsed < this->retransmit_timeout()) {
+			break;
+		}
+
+		if ((this->state == RECV_ACK || this->state == LAST_ACK)
+				&& this->control_transmissions >= MAX_FIN_TRANSMISSIONS) {
+			RDT_LOG(RDT_LOG_WARN, "No FINACK after " << MAX_FIN_TRANSMISSIONS << " FINs. Giving up.\n");
+			this->finish_close();
+			break;
+		} else if (this->state == SYN_ACK 
+				&& this->control_transmissions >= MAX_SYNACK_TRANSMISSIONS) {
+			RDT_LOG(RDT_LOG_INFO, "No ACK after " << MAX_SYNACK_TRANSMISSIONS << " SYNACKs. Giving up.\n");
+			this->finish_close();
+			break;
+		}
+
+		this->stats.add(RDTStatCounters::TIMEOUTS);
+		RDT_LOG(RDT_LOG_INFO, "Timeout: resending " << ((this->state == SYN) ? "RDT_SYN" : 
+				(this->state == SYN_ACK) ? "RDT_SYNACK" : "RDT_FIN") << ".\n");
+		this->send_control((this->state == SYN) ? RDT_SYN : 
+						   (this->state == SYN_ACK) ? RDT_SYNACK : RDT_FIN);
+		this->retransmit_timer_start = current_usec();
+		this->control_transmissions++;
+		break;
+
+	case SEND_ACK:
+		if (elapsed >= (uint64_t)TIME_WAIT_MS * 1000) {
+			RDT_LOG(RDT_LOG_INFO, "Sent FINACK. Timeout complete.\n");
+			this->finish_close();
+		}
+		break;
+
+	default:
+		if (!this->unacked_segments.empty() 
+				&& elapsed >= this->retransmit_timeout()) {
+			this->retransmit_oldest();
+		} else if (this->send_stalled && this->unacked_segments.empty()
+				&& elapsed >= this->retransmit_timeout()) {
+			// The receiver had no room, and the ACK saying it has again may
+			// have been lost: ask it again
+			RDT_LOG(RDT_LOG_DEBUG, "Receive window closed: probing it.\n");
+			this->send_control(RDT_WINDOW_PROBE);
+			this->retransmit_timer_start = current_usec();
+		}
+
+		if (this->probe_size == 0 
+				|| current_usec() - this->probe_sent < this->retransmit_timeout()) {
+			break;
+		} else if (this->probe_transmissions < MAX_PROBE_TRANSMISSIONS) {
+			this->transmit_probe();
+		} else {
+			// Too big for the path, so look between there and what works
+			RDT_LOG(RDT_LOG_DEBUG, "Path MTU probe: " << this->probe_size 
+					<< " byte segments don't get through.\n");
+			this->probe_ceiling = this->probe_size - 1;
+			this->send_probe((this->seg_size + this->probe_ceiling + 1) / 2);
+		}
+		break;
+	}
+}
+
+void ReliableSocket::send_probe(int size) {
+	if (size - this->seg_size < PROBE_GRANULARITY) {
+		RDT_LOG(RDT_LOG_DEBUG, "Path MTU probing done: sending " << this->seg_size 
+				<< " byte segments.\n");
+		this->probe_size = 0;
+		return;
+	}
+
+	this->probe_size 			= size;
+	this->probe_transmissions 	= 0;
+	this->transmit_probe();
+}
+
+void ReliableSocket::transmit_probe() {
+	RDTHeader *hdr 			= &this->probe_header;
 	hdr->sequence_number 	= htonl(0);
-	hdr->type 				= RDT_FIN;
-	
-	do
-	{
-		cerr << "Sending FIN message.\n";
-		memset(recv_segment, 0, MAX_SEG_SIZE);
-		this->send_and_wait(send_segment, sizeof(RDTHeader), recv_segment);
-		hdr = (RDTHeader*)recv_segment;
-	} while (hdr->type != RDT_FINACK);
-
-	cerr << "Received FINACK. Connection Closed.\n";
+	hdr->ack_number 		= htonl(0);
+	hdr->type 				= RDT_PROBE;
+	hdr->flags 				= 0;
+	hdr->connection_id 		= htons(this->connection_id);
+	this->stamp_header(hdr);
+
+	struct iovec iov[2];
+	iov[0].iov_base = hdr;
+	iov[0].iov_len 	= sizeof(RDTHeader);
+	iov[1].iov_base = (void*)probe_padding;
+	iov[1].iov_len 	= this->probe_size - sizeof(RDTHeader);
+	set_checksum(hdr, &iov[1], 1);
+
+	this->io.queue_send(iov, 2);
+	this->stats.add(RDTStatCounters::SEGMENTS_SENT);
+	this->probe_sent = current_usec();
+	this->probe_transmissions++;
+}
+
+void ReliableSocket::handle_probe_ack(uint32_t size) {
+	if (this->probe_size == 0 || size != (uint32_t)this->probe_size) {
+		// A late answer to an earlier probe
+		return;
+	}
+
+	RDT_LOG(RDT_LOG_DEBUG, "Path MTU probe: " << size << " byte segments get through.\n");
+	this->seg_size = this->probe_size;
+	this->send_probe((this->seg_size + this->probe_ceiling + 1) / 2);
+}
+
+void ReliableSocket::fall_back_segment_size(int failed_size) {
+	RDT_LOG(RDT_LOG_DEBUG, "Path MTU: " << failed_size << " byte segments stopped getting "
+			<< "through, going back to " << DEFAULT_SEG_SIZE << ".\n");
+	this->seg_size 			= DEFAULT_SEG_SIZE;
+	this->probe_ceiling 	= failed_size - 1;
+	this->probe_size 		= 0;
+	this->fragment_until 	= this->sequence_number;
+	this->set_fragmenting(true);
+}
+
+void ReliableSocket::set_fragmenting(bool enabled) {
+	this->fragmenting = enabled;
+
+	// A listener's transport is shared, so it keeps count
+	if (this->listener != NULL) {
+		this->listener->set_fragmenting(enabled);
+		return;
+	}
+
+	int discover = enabled ? IP_PMTUDISC_DONT : IP_PMTUDISC_PROBE;
+	if (this->transport->set_option(IPPROTO_IP, IP_MTU_DISCOVER, 
+									&discover, sizeof(discover)) < 0) {
+		perror("setsockopt");
+	}
+}
+
+int64_t ReliableSocket::next_timeout() {
+	int64_t length;
+	switch (this->state) {
+	case SYN:
+	case SYN_ACK:
+	case RECV_ACK:
+	case LAST_ACK:
+		length = this->retransmit_timeout();
+		break;
+
+	case SEND_ACK:
+		length = (int64_t)TIME_WAIT_MS * 1000;
+		break;
+
+	default:
+		length = (!this->unacked_segments.empty() || this->send_stalled) 
+					? (int64_t)this->retransmit_timeout() : -1;
+		break;
+	}
+
+	int64_t now 		= current_usec();
+	int64_t time_left 	= -1;
+	if (length >= 0) {
+		time_left = this->retransmit_timer_start + length - now;
+		time_left = (time_left > 0) ? time_left : 0;
+	}
+
+	// A path MTU probe may run out first
+	if (this->probe_size != 0) {
+		int64_t probe_left = this->probe_sent + this->retransmit_timeout() - now;
+		probe_left = (probe_left > 0) ? probe_left : 0;
+		if (time_left < 0 || probe_left < time_left) {
+			time_left = probe_left;
+		}
+	}
+	return time_left;
+}
+
+bool ReliableSocket::is_readable() {
+	return this->reassembly_buffer.find(this->sequence_number) != NULL
+			|| this->state == FIN_STATE;
+}
+
+bool ReliableSocket::is_writable() {
+	return this->state == ESTABLISHED && !this->close_pending
+			&& this->unacked_segments.size() < this->send_window();
+}
+
+void ReliableSocket::update_timer() {
+	if (this->timer_wheel == NULL) {
+		return;
+	}
+
+	// A socket that closed outside of the reactor's run_once gets a timer
+	// that is already due, so that the reactor removes it right away
+	int64_t time_left = (this->state == CLOSED) ? 0 : this->next_timeout();
+	if (time_left < 0) {
+		this->timer_wheel->cancel(&this->timer);
+	} else {
+		// The wheel ticks in milliseconds: round up, so it never fires early
+		uint64_t deadline = current_usec() + time_left;
+		this->timer_wheel->schedule(&this->timer, (deadline + 999) / 1000);
+	}
+}
+
+void ReliableSocket::process_ack(char *recv_segment, int recv_count, bool window_moved) {
+	RDTHeader *hdr = (RDTHeader*)recv_segment;
+	if (recv_count < (int)sizeof(RDTHeader) || hdr->type != RDT_ACK) {
+		RDT_LOG(RDT_LOG_DEBUG, "Received segment was not an ACK." << hdr->type << "\n");
+		return;
+	}
+
+	RDT_LOG(RDT_LOG_TRACE, "Received ACK Number: #" << ntohl(hdr->ack_number) << ".\n");
+
+	// The SACK blocks go first, so we know whether a duplicate ACK told us
+	// anything new
+	uint32_t new_sacks = 0;
+	if (hdr->flags & RDT_FLAG_SACK) {
+		int num_blocks = (recv_count - sizeof(RDTHeader)) / sizeof(RDTSackBlock);
+		new_sacks = this->handle_sack((RDTSackBlock*)(hdr + 1), num_blocks);
+	}
+
+	this->handle_ack(ntohl(hdr->ack_number), this->sample_rtt(hdr),
+					 this->sack_enabled ? new_sacks > 0 : !window_moved);
+}
+
+bool ReliableSocket::update_peer_window(const RDTHeader *hdr) {
+	// The edge only moves forward: a late ACK may carry an older one
+	uint32_t edge = ntohl(hdr->ack_number) + ntohl(hdr->window);
+	if ((int32_t)(edge - this->peer_window_edge) <= 0) {
+		return false;
+	}
+
+	this->peer_window_edge = edge;
+	return true;
+}
+
+uint32_t ReliableSocket::receive_window() {
+	// The reassembly buffer has room for REASSEMBLY_BUFFER_SIZE segments
+	// from the next one the application hasn't taken yet
+	uint32_t window = this->sequence_number + REASSEMBLY_BUFFER_SIZE 
+						- this->expected_sequence_number;
+	return (window < this->recv_buffer_segments) ? window : this->recv_buffer_segments;
+}
+
+void ReliableSocket::measure_receive_buffer() {
+	int size;
+	socklen_t length = sizeof(size);
+	if (this->transport->get_option(SOL_SOCKET, SO_RCVBUF, &size, &length) < 0) {
+		perror("getsockopt");
+		return;
+	}
+
+	this->recv_buffer_segments = size / (this->seg_size_limit + RECV_BUFFER_OVERHEAD);
+	if (this->recv_buffer_segments < 1) {
+		this->recv_buffer_segments = 1;
+	}
+}
+
+void ReliableSocket::handle_ack(uint32_t ack_number, int rtt_sample, bool new_sacks) {
+	// (Sequence numbers wrap around, so they're compared by their difference)
+	if (this->unacked_segments.empty() 
+			|| (int32_t)(ack_number - this->unacked_segments.first()) <= 0) {
+		// Nothing new was acknowledged: either a duplicate ACK, or one that
+		// was overtaken by a later ACK on the way
+		RDT_LOG(RDT_LOG_TRACE, "Out of order ACK: " << ack_number << ".\n");
+		if (!this->unacked_segments.empty() && ack_number == this->unacked_segments.first()) {
+			this->stats.add(RDTStatCounters::DUPLICATE_ACKS);
+			if (new_sacks) {
+				this->handle_dup_ack();
+			}
+		} else {
+			this->stats.add(RDTStatCounters::OUT_OF_ORDER_ACKS);
+		}
+		return;
+	}
+
+	// The retransmission queue has no gaps, so everything from its start up
+	// to the ack number goes
+	uint32_t end = ((int32_t)(ack_number - this->unacked_segments.end()) < 0) ? ack_number 
+					: this->unacked_segments.end();
+	uint32_t num_acked = 0;
+	int64_t bytes_acked = 0;
+	for (uint32_t seq = this->unacked_segments.first(); seq != end; seq++) {
+		RDTSentSegment *sent = this->unacked_segments.find(seq);
+		num_acked++;
+		for (int i = 0; i < sent->payload_iovcnt; i++) {
+			bytes_acked += sent->payload[i].iov_len;
+		}
+	}
+	this->stats.add(RDTStatCounters::BYTES_IN_FLIGHT, -bytes_acked);
+	this->stats.add(RDTStatCounters::BYTES_ACKED, bytes_acked);
+
+	// The sample times the transmission that made the receiver send this ACK
+	// (whose timestamp it echoed), so resent segments don't muddle it
+	if (rtt_sample >= 0) {
+		this->curr_rtt = rtt_sample;
+		this->set_estimated_rtt();
+	}
+
+	// Queued sends may point into the segments (and repair segments) we're
+	// about to free
+	this->io.flush_sends();
+	while (!this->unacked_segments.empty() && this->unacked_segments.first() != end) {
+		uint32_t seq = this->unacked_segments.first();
+		RDTSentSegment *sent = this->unacked_segments.find(seq);
+		if (sent->buffer_id >= 0) {
+			this->segment_pool.release(sent->buffer_id);
+		}
+		this->unacked_segments.erase(seq);
+	}
+	for (size_t i = 0; i < this->fec_sent_buffers.size(); i++) {
+		this->segment_pool.release(this->fec_sent_buffers[i]);
+	}
+	this->fec_sent_buffers.clear();
+	this->congestion_control->on_ack(num_acked, rtt_sample);
+
+	// We made progress, so restart the retransmission timer
+	this->retransmit_timer_start 	= current_usec();
+	this->dup_acks 					= 0;
+	this->consecutive_timeouts 		= 0;
+
+	if (this->fragmenting && (this->unacked_segments.empty() 
+			|| (int32_t)(this->unacked_segments.first() - this->fragment_until) >= 0)) {
+		// Everything cut to the size that stopped getting through is in
+		this->set_fragmenting(false);
+		this->send_probe((this->seg_size + this->probe_ceiling + 1) / 2);
+	}
+
+	if (this->in_recovery && this->recovery_undo_possible) {
+		// If this echoes a timestamp from before the fast retransmit, the
+		// original got through: it was only reordered (RFC 3522)
+		this->recovery_undo_possible = false;
+		if (rtt_sample >= 0 && current_usec() - rtt_sample < this->recovery_start) {
+			RDT_LOG(RDT_LOG_DEBUG, "Fast retransmit was spurious, undoing it.\n");
+			this->congestion_control->on_spurious_loss();
+			this->in_recovery 			= false;
+			this->recovery_inflation 	= 0;
+		}
+	}
+
+	if (this->in_recovery) {
+		if ((int32_t)(ack_number - this->recovery_point) >= 0) {
+			// Everything that was in flight when we lost the segment is in
+			this->in_recovery 			= false;
+			this->recovery_inflation 	= 0;
+		} else if (!this->unacked_segments.empty()) {
+			// A partial ACK: the next segment was lost too (NewReno), and
+			// the segments it ACKed no longer inflate the window
+			this->recovery_inflation = (this->recovery_inflation > num_acked)
+										? this->recovery_inflation - num_acked : 0;
+			this->fast_retransmit();
+		}
+	}
+}
+
+void ReliableSocket::handle_dup_ack() {
+	this->dup_acks++;
+	if (this->in_recovery) {
+		this->recovery_inflation++;
+		return;
+	} else if (!RDTArqPolicy::FAST_RETRANSMIT || this->dup_ack_threshold == 0 
+			|| this->dup_acks != this->dup_ack_threshold) {
+		return;
+	}
+
+	RDT_LOG(RDT_LOG_DEBUG, this->dup_acks << " duplicate ACKs: resending Sequence Number: #"
+			<< this->unacked_segments.first() << ".\n");
+	this->congestion_control->on_loss();
+	this->in_recovery 				= true;
+	this->recovery_point 			= this->sequence_number;
+	this->recovery_inflation 		= this->dup_ack_threshold;
+	this->recovery_start 			= current_usec();
+	this->recovery_undo_possible 	= true;
+	this->fast_retransmit();
+}
+
+void ReliableSocket::fast_retransmit() {
+	RDTSentSegment &sent = *this->unacked_segments.find(this->unacked_segments.first());
+	this->queue_segment(sent);
+	sent.last_sent = current_usec();
+	sent.transmissions++;
+	this->stats.add(RDTStatCounters::RETRANSMISSIONS);
+	this->stats.add(RDTStatCounters::FAST_RETRANSMITS);
+}
+
+uint32_t ReliableSocket::handle_sack(const RDTSackBlock *blocks, int num_blocks) {
+	uint32_t newly_sacked = 0;
+	for (int i = 0; i < num_blocks; i++) {
+		uint32_t start 	= ntohl(blocks[i].start);
+		uint32_t end 	= ntohl(blocks[i].end);
+
+		// Only what is still in the retransmission queue (sequence numbers
+		// wrap around, so they're compared by their difference)
+		if ((int32_t)(start - this->unacked_segments.first()) < 0) {
+			start = this->unacked_segments.first();
+		}
+		if ((int32_t)(end - this->unacked_segments.end()) > 0) {
+			end = this->unacked_segments.end();
+		}
+		for (uint32_t seq = start; (int32_t)(seq - end) < 0; seq++) {
+			RDTSentSegment *sent = this->unacked_segments.find(seq);
+			newly_sacked += !sent->sacked;
+			sent->sacked = true;
+		}
+	}
+
+	return newly_sacked;
+}
+
+void ReliableSocket::retransmit_oldest() {
+	this->retransmit_timer_start = current_usec();
+	if (this->unacked_segments.empty()) {
+		return;
+	}
+	this->congestion_control->on_timeout();
+	this->stats.add(RDTStatCounters::TIMEOUTS);
+	this->consecutive_timeouts++;
+
+	// Segments of the size probing found may have stopped getting through
+	RDTSentSegment &oldest = *this->unacked_segments.find(this->unacked_segments.first());
+	int oldest_size = sizeof(RDTHeader);
+	for (int i = 0; i < oldest.payload_iovcnt; i++) {
+		oldest_size += oldest.payload[i].iov_len;
+	}
+	if (this->pmtu_probing && !this->fragmenting && oldest_size > DEFAULT_SEG_SIZE
+			&& this->consecutive_timeouts >= MAX_LARGE_SEGMENT_TIMEOUTS) {
+		this->fall_back_segment_size(oldest_size);
+	}
+
+	// A timeout ends fast recovery: we start over from a window of one
+	this->in_recovery 				= false;
+	this->recovery_inflation 		= 0;
+	this->recovery_undo_possible 	= false;
+	this->dup_acks 					= 0;
+
+	// With selective repeat the receiver buffers out of order segments, so
+	// only the one at the start of the window needs to be resent, plus any
+	// holes that the SACK blocks have shown us (i.e. unsacked segments below
+	// a sacked one). Otherwise we go back and resend the lot.
+	uint32_t first 		= this->unacked_segments.first();
+	uint32_t holes_end 	= this->unacked_segments.end();
+	if (!RDTArqPolicy::GO_BACK) {
+		while (holes_end != first && !this->unacked_segments.find(holes_end - 1)->sacked) {
+			holes_end--;
+		}
+		if (holes_end == first) {
+			// Nothing sacked, so just the oldest one
+			holes_end = first + 1;
+		}
+	}
+
+	for (uint32_t seq = first; seq != holes_end; seq++) {
+		RDTSentSegment &sent = *this->unacked_segments.find(seq);
+		if (sent.sacked) {
+			continue;
+		}
+
+		RDT_LOG(RDT_LOG_DEBUG, "Timeout: resending Sequence Number: #" << seq << ".\n");
+		this->queue_segment(sent);
+		sent.last_sent = this->retransmit_timer_start;
+		sent.transmissions++;
+		this->stats.add(RDTStatCounters::RETRANSMISSIONS);
+	}
+}
+
+void ReliableSocket::flush_send_window() {
+	while (!this->unacked_segments.empty() && this->state == ESTABLISHED) {
+		this->wait_for_events();
+	}
+}
+
+
+int ReliableSocket::receive_data(char buffer[MAX_DATA_SIZE]) {
+	RDTRecvView view = this->receive_view();
+	if (view.length > 0) {
+		memcpy(buffer, view.data, view.length);
+	}
+	this->release_view(view);
+
+	return view.length;
+}
+
+void ReliableSocket::release_view(const RDTRecvView &view) {
+	if (view.buffer_id >= 0) {
+		this->recv_io->release(view.buffer_id);
+	}
+}
+
+RDTRecvView ReliableSocket::receive_view() {
+	RDTRecvView view = { NULL, -1, -1 };
+	while (true) {
+		// Hand over the next segment once it has arrived. Its reference on
+		// the buffer now belongs to the caller.
+		RDTRecvView *next = this->reassembly_buffer.find(this->sequence_number);
+		if (next != NULL) {
+			view = *next;
+			this->reassembly_buffer.erase(this->sequence_number);
+			++this->sequence_number;
+			this->stats.add(RDTStatCounters::BYTES_DELIVERED, view.length);
+
+			// Once the application has made room for half the largest window
+			// we could advertise, tell a sender that may be waiting for it
+			uint32_t max_window = (this->recv_buffer_segments < REASSEMBLY_BUFFER_SIZE)
+									? this->recv_buffer_segments : REASSEMBLY_BUFFER_SIZE;
+			uint32_t edge = this->expected_sequence_number + this->receive_window();
+			if ((int32_t)(edge - this->advertised_window_edge) >= (int32_t)((max_window + 1) / 2)) {
+				RDT_LOG(RDT_LOG_TRACE, "Sending window update.\n");
+				this->send_ack(this->expected_sequence_number);
+				this->io.flush_sends();
+			}
+			return view;
+		}
+
+		if (this->state == FIN_STATE) {
+			// The sender is done and we've delivered everything
+			view.length = 0;
+			return view;
+		} else if (this->state != ESTABLISHED && this->state != SYN_ACK) {
+			RDT_LOG(RDT_LOG_WARN, "INFO: Cannot receive: Connection not established.\n");
+			return view;
+		} else if (this->nonblocking) {
+			errno = EAGAIN;
+			return view;
+		}
+
+		this->wait_for_events();
+	}
+}
+
+int64_t ReliableSocket::receive_file(int fd) {
+	if (this->nonblocking) {
+		RDT_LOG(RDT_LOG_WARN, "INFO: Cannot receive: Files need a blocking socket.\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	RDTRecvView views[FILE_WRITE_BATCH];
+	struct iovec pieces[FILE_WRITE_BATCH];
+	int64_t total = 0;
+	while (true) {
+		// Wait for the next segment, then take along every segment after it
+		// that is already here
+		int count = 0;
+		RDTRecvView view = this->receive_view();
+		while (view.length > 0) {
+			views[count] 			= view;
+			pieces[count].iov_base 	= (void*)view.data;
+			pieces[count].iov_len 	= view.length;
+			total += view.length;
+			count++;
+
+			if (count == FILE_WRITE_BATCH 
+					|| this->reassembly_buffer.find(this->sequence_number) == NULL) {
+				break;
+			}
+			view = this->receive_view();
+		}
+
+		int result = write_fully(fd, pieces, count);
+		int write_errno = errno;
+		for (int i = 0; i < count; i++) {
+			this->release_view(views[i]);
+		}
+
+		if (result < 0) {
+			errno = write_errno;
+			return -1;
+		} else if (view.length == 0) {
+			// The remote host closed the connection
+			return total;
+		} else if (view.length < 0) {
+			return -1;
+		}
+	}
+}
+
+void ReliableSocket::process_data(const RDTHeader *hdr, const RDTRecvView &data) {
+	uint32_t received_seq_num = ntohl(hdr->sequence_number);
+	RDT_LOG(RDT_LOG_TRACE, "Received segment. " 
+		 << "seq_num = "<< received_seq_num << ", "
+		 << "ack_num = "<< ntohl(hdr->ack_number) << ", "
+		 << ", type = " << hdr->type << "\n");
+
+	// Hold on to it until it can be delivered in order
+	if (received_seq_num != this->expected_sequence_number) {
+		RDT_LOG(RDT_LOG_TRACE, "\nOut of order data packet.\n\n");
+	}
+	if (this->buffer_received_data(received_seq_num, data)) {
+		this->fec_add_data(received_seq_num, data);
+	}
+
+	// No matter what, we ack the data that we just received
+	this->send_ack(received_seq_num);
+}
+
+void ReliableSocket::send_ack(uint32_t seq_num) {
+	// ACKs are cumulative: the ack number is the first sequence number we
+	// are still missing.
+	char send_segment[sizeof(RDTHeader) + MAX_SACK_BLOCKS * sizeof(RDTSackBlock)];
+	static_assert(sizeof(send_segment) <= DatagramIO::MAX_COPY_SIZE, "ACKs are sent as copies");
+	RDTHeader *ack 			= (RDTHeader*)send_segment;
+	ack->ack_number 		= htonl(this->expected_sequence_number);
+	ack->sequence_number 	= htonl(seq_num);
+	ack->type 				= RDT_ACK;
+	ack->flags 				= 0;
+	ack->connection_id 		= htons(this->connection_id);
+	this->stamp_header(ack);
+
+	// Tell the sender about anything we have past the gap
+	int ack_size = sizeof(RDTHeader);
+	if (this->sack_enabled && !this->reassembly_buffer.empty()
+			&& this->reassembly_buffer.end() > this->expected_sequence_number) {
+		ack->flags |= RDT_FLAG_SACK;
+		ack_size += this->fill_sack_blocks((RDTSackBlock*)(ack + 1)) 
+					* sizeof(RDTSackBlock);
+	}
+	struct iovec sack_blocks = { ack + 1, ack_size - sizeof(RDTHeader) };
+	set_checksum(ack, &sack_blocks, 1);
+
+	// Queue the Ack; it goes out with the rest of this batch's ACKs
+	this->io.queue_send_copy(send_segment, ack_size);
+	this->stats.add(RDTStatCounters::SEGMENTS_SENT);
+	RDT_LOG(RDT_LOG_TRACE, "ACKed up to segment number #" << this->expected_sequence_number << "\n");
+}
+
+bool ReliableSocket::buffer_received_data(uint32_t seq_num, const RDTRecvView &view) {
+	// Ignore duplicates and anything too far past what we've delivered (or,
+	// unless we do selective repeat, anything past a gap)
+	if ((int32_t)(seq_num - this->expected_sequence_number) < 0
+			|| (!RDTArqPolicy::BUFFER_OUT_OF_ORDER && seq_num != this->expected_sequence_number)
+			|| seq_num - this->sequence_number >= REASSEMBLY_BUFFER_SIZE
+			|| this->reassembly_buffer.find(seq_num) != NULL) {
+		return false;
+	}
+
+	this->recv_io->retain(view.buffer_id);
+	this->reassembly_buffer.insert(seq_num) = view;
+	while (this->reassembly_buffer.find(this->expected_sequence_number) != NULL) {
+		++this->expected_sequence_number;
+	}
+	return true;
+}
+
+void ReliableSocket::fec_add_data(uint32_t seq_num, const RDTRecvView &data) {
+	uint32_t block_size = this->peer_fec_block_size;
+	if (block_size == 0) {
+		return;
+	}
+
+	// Blocks we have every segment of have nothing left to rebuild
+	while (!this->fec_blocks.empty() 
+			&& (this->fec_blocks.first() + 1) * block_size <= this->expected_sequence_number) {
+		this->fec_forget(this->fec_blocks.first() * block_size);
+	}
+	uint32_t first = seq_num - seq_num % block_size;
+	if (first + block_size <= this->expected_sequence_number) {
+		return;
+	}
+
+	RDTFecBlock &block = this->fec_block(first);
+	if (data.length > (int)(this->seg_size_limit - sizeof(RDTHeader))) {
+		return;
+	}
+
+	xor_into(this->segment_pool.get(block.buffer_id), data.data, data.length);
+	block.length_xor 	^= data.length;
+	block.received 		|= (uint64_t)1 << (seq_num - first);
+	this->fec_recover(first);
+}
+
+bool ReliableSocket::fec_add_repair(const RDTHeader *hdr, const char *parity, int length) {
+	uint32_t block_size 	= this->peer_fec_block_size;
+	uint32_t first 			= ntohl(hdr->sequence_number);
+	uint32_t num_segments 	= ntohl(hdr->ack_number) >> 16;
+	if (block_size == 0 || first % block_size != 0 
+			|| num_segments == 0 || num_segments > block_size
+			|| first + num_segments <= this->expected_sequence_number
+			|| first >= this->sequence_number + REASSEMBLY_BUFFER_SIZE) {
+		return false;
+	}
+
+	RDTFecBlock &block = this->fec_block(first);
+	if (block.num_segments != 0 || length > (int)(this->seg_size_limit - sizeof(RDTHeader))) {
+		// A duplicate (or too big to be for this connection's segments)
+		return false;
+	}
+
+	xor_into(this->segment_pool.get(block.buffer_id), parity, length);
+	block.length_xor 	^= ntohl(hdr->ack_number) & 0xffff;
+	block.num_segments 	= num_segments;
+	return this->fec_recover(first);
+}
+
+RDTFecBlock &ReliableSocket::fec_block(uint32_t first) {
+	uint32_t number = first / this->peer_fec_block_size;
+	if (this->fec_blocks.find(number) != NULL) {
+		return *this->fec_blocks.find(number);
+	}
+
+	RDTFecBlock &block 	= this->fec_blocks.insert(number);
+	block.buffer_id 	= this->segment_pool.acquire();
+	block.length_xor 	= 0;
+	block.received 		= 0;
+	block.num_segments 	= 0;
+	memset(this->segment_pool.get(block.buffer_id), 0, this->seg_size_limit - sizeof(RDTHeader));
+	return block;
+}
+
+void ReliableSocket::fec_forget(uint32_t first) {
+	uint32_t number = first / this->peer_fec_block_size;
+	RDTFecBlock *block = this->fec_blocks.find(number);
+	if (block != NULL) {
+		this->segment_pool.release(block->buffer_id);
+		this->fec_blocks.erase(number);
+	}
+}
+
+bool ReliableSocket::fec_recover(uint32_t first) {
+	RDTFecBlock &block = *this->fec_blocks.find(first / this->peer_fec_block_size);
+
+	// Until the repair segment arrives, we don't know how many segments the
+	// block has (it may be the short last one), so it could still be missing
+	// any number of them
+	uint32_t num_segments = (block.num_segments != 0) ? block.num_segments 
+							: this->peer_fec_block_size;
+	uint64_t missing = low_bits(num_segments) & ~block.received;
+	if (missing == 0) {
+		this->fec_forget(first);
+		return false;
+	} else if (block.num_segments == 0 || (missing & (missing - 1)) != 0) {
+		return false;
+	}
+
+	// Everything but the missing segment cancels out of the XOR
+	uint32_t seq_num 	= first + __builtin_ctzll(missing);
+	uint32_t length 	= block.length_xor;
+	if (length > this->seg_size_limit - sizeof(RDTHeader)) {
+		this->fec_forget(first);
+		return false;
+	}
+
+	char *data;
+	RDTRecvView view;
+	view.buffer_id 	= this->recv_io->acquire(&data);
+	view.data 		= data;
+	view.length 	= length;
+	memcpy(data, this->segment_pool.get(block.buffer_id), length);
+	this->fec_forget(first);
+
+	bool rebuilt = this->buffer_received_data(seq_num, view);
+	this->recv_io->release(view.buffer_id);
+	if (rebuilt) {
+		RDT_LOG(RDT_LOG_DEBUG, "Rebuilt segment #" << seq_num << " from its FEC block.\n");
+		this->stats.add(RDTStatCounters::FEC_REBUILT);
+	}
+	return rebuilt;
+}
+
+
+int ReliableSocket::fill_sack_blocks(RDTSackBlock blocks[MAX_SACK_BLOCKS]) {
+	int num_blocks = 0;
+	uint32_t seq = this->expected_sequence_number;
+	while (seq < this->reassembly_buffer.end() && num_blocks < MAX_SACK_BLOCKS) {
+		if (this->reassembly_buffer.find(seq) == NULL) {
+			++seq;
+			continue;
+		}
+
+		// Extend the block for as long as the sequence numbers are contiguous
+		uint32_t start 	= seq;
+		uint32_t end 	= start + 1;
+		while (this->reassembly_buffer.find(end) != NULL) {
+			++end;
+		}
+		seq = end;
+
+		blocks[num_blocks].start 	= htonl(start);
+		blocks[num_blocks].end 		= htonl(end);
+		num_blocks++;
+	}
+
+	return num_blocks;
+}
+
+
+void ReliableSocket::close_connection() {
+	// The last block is cut short. Its repair segment matters most, since a
+	// loss at the very end is otherwise only noticed once the timer runs out.
+	if (this->state == ESTABLISHED && this->fec_length > 0) {
+		this->send_fec();
+	}
+
+	// Everything we sent has to be acknowledged before we start closing.
+	if (this->state == ESTABLISHED && !this->unacked_segments.empty()) {
+		if (this->nonblocking) {
+			// The FIN goes out with the last ACK (see process_segment)
+			this->close_pending = true;
+			return;
+		}
+		this->flush_send_window();
+	}
+
+	this->start_close();
+	if (this->nonblocking) {
+		this->io.flush_sends();
+		this->update_timer();
+		return;
+	}
+
+	while (this->state != CLOSED) {
+		this->wait_for_events();
+	}
+}
+
+void ReliableSocket::start_close() {
+	this->stats.mark_end(current_msec());
+	this->probe_size = 0;
+	switch (this->state) {
+	case ESTABLISHED:
+		// Construct a RDT_FIN message to indicate to the remote host that we
+		// want to end this connection. We then wait for its FINACK and FIN.
+		RDT_LOG(RDT_LOG_INFO, "Sender.\n");
+		this->send_control(RDT_FIN);
+		RDT_LOG(RDT_LOG_INFO, "Sent the RDT_FIN.\n");
+		this->state = RECV_ACK;
+		break;
+
+	case FIN_STATE:
+		// The remote host already sent its FIN, so we only need our FIN to
+		// be FINACKed
+		RDT_LOG(RDT_LOG_INFO, "Receiver.\n");
+		RDT_LOG(RDT_LOG_INFO, "Sending FIN message.\n");
+		this->send_control(RDT_FIN);
+		this->state = LAST_ACK;
+		break;
+
+	case INIT:
+	case LISTEN:
+	case SYN:
+	case SYN_ACK:
+		// Never got connected, so there's nobody to tell
+		this->finish_close();
+		return;
+
+	default:
+		// Already closing
+		return;
+	}
+
+	this->retransmit_timer_start 	= current_usec();
+	this->control_transmissions 	= 1;
+}
+
+void ReliableSocket::finish_close() {
+	this->io.flush_sends();
+	this->state = CLOSED;
+
+	// Nobody can receive whatever is left now
+	uint32_t seq;
+	for (seq = this->reassembly_buffer.first(); seq != this->reassembly_buffer.end(); seq++) {
+		RDTRecvView *view = this->reassembly_buffer.find(seq);
+		if (view != NULL) {
+			this->recv_io->release(view->buffer_id);
+		}
+	}
+	this->reassembly_buffer.clear();
+	this->fec_blocks.clear();
+
+	// A listener's transport is shared with its other connections
+	if (this->listener != NULL) {
+		this->listener->forget(this);
+	} else if (this->transport->close() < 0) {
+		perror("close_connection close");
+	}
 }
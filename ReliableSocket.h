@@ -6,43 +6,230 @@
  *
  */
 
-enum RDTMessageType : uint8_t {RDT_SYN, RDT_SYNACK, RDT_FIN, RDT_FINACK, RDT_ACK, RDT_DATA};
+#ifndef RELIABLE_SOCKET_H
+#define RELIABLE_SOCKET_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "CongestionControl.h"
+#include "DatagramIO.h"
+#include "DatagramTransport.h"
+#include "RDTPolicy.h"
+#include "RDTStats.h"
+#include "SequenceRing.h"
+#include "TimerWheel.h"
+
+/**
+ * Types of segment. Besides the handshake, data and teardown segments:
+ *
+ * RDT_PROBE: A path MTU probe, padded to the segment size being tried.
+ * RDT_PROBEACK: The answer to a probe; its ack number is the probe's size.
+ * RDT_WINDOW_PROBE: Asks the receiver to repeat its window (in an ACK),
+ * 		when it last said it had no room.
+ * RDT_FEC: A repair segment for a block of data segments (see
+ * 		set_fec_block_size). Its sequence number is the block's first, the
+ * 		top 16 bits of its ack number the number of segments in the block
+ * 		and the bottom 16 the XOR of their lengths. The payload is the XOR
+ * 		of their data, each zero padded to the longest.
+ */
+enum RDTMessageType : uint8_t {RDT_SYN, RDT_SYNACK, RDT_FIN, RDT_FINACK, RDT_ACK, RDT_DATA,
+							   RDT_PROBE, RDT_PROBEACK, RDT_WINDOW_PROBE, RDT_FEC};
+
+/**
+ * Bits that can be set in the flags field of the header.
+ *
+ * RDT_FLAG_SACK: On a SYN, the initiator can process selective ACKs. On an
+ * ACK, the payload is a list of RDTSackBlocks.
+ *
+ * RDT_FLAG_MSS: On a SYN or SYNACK, the payload is an RDTSynOptions.
+ *
+ * RDT_FLAG_CHECKSUM: On a SYN or SYNACK, its sender checksums every segment
+ * it sends (this one included), so the other end must check them all. Ends
+ * built without checksums leave it clear and send a checksum of 0.
+ */
+enum RDTHeaderFlags : uint8_t { RDT_FLAG_SACK = 0x01, RDT_FLAG_MSS = 0x02, 
+								RDT_FLAG_CHECKSUM = 0x04 };
 
 /**
  * Format for the header of a segment send by our reliable socket.
+ *
+ * The connection ID is picked by the initiator and carried by every segment
+ * of the connection in both directions. It tells a connection apart from
+ * earlier ones from the same address, and lets a listener shared by many
+ * remote hosts tell which connection a segment belongs to.
+ *
+ * Every segment carries the time it was sent (in microseconds, from the
+ * sender's clock) and echoes the timestamp of the last segment received from
+ * the other side (0 if none yet). An ACK thereby says exactly which
+ * transmission it answers, so RTT samples are never ambiguous, even for
+ * retransmitted segments.
+ *
+ * Every segment also carries the sender's receive window: how many segments
+ * past its ack number it has room for in its reassembly buffer. The other
+ * side never sends past ack_number + window (the right edge of the window).
+ *
+ * The checksum is the CRC32C of the rest of the header and the payload.
+ * UDP's own checksum is weak (and optional over IPv4), so a segment whose
+ * checksum doesn't match is dropped as if it had been lost. A checksum of 0
+ * means the sender was built without them (see RDTPolicy.h) and isn't
+ * checked.
  */
 struct RDTHeader {
 	uint32_t 		sequence_number;
 	uint32_t 		ack_number;
 	RDTMessageType 	type;
+	uint8_t 		flags;
+	uint16_t 		connection_id;
+	uint32_t 		timestamp;
+	uint32_t 		timestamp_echo;
+	uint32_t 		window;
+	uint32_t 		checksum; 		// must stay last (see set_checksum)
+};
+
+/**
+ * What each end tells the other when connecting. Carried (in network byte
+ * order) as the payload of the SYN and SYNACK, with RDT_FLAG_MSS set.
+ */
+struct RDTSynOptions {
+	uint32_t 		max_segment_size; 	// largest segment it takes
+	uint32_t 		fec_block_size; 	// segments per FEC block it sends (0 for none)
 };
 
-enum connection_status { INIT, SYN, SYN_ACK, ACK_EST, ESTABLISHED, FIN_STATE, RECV_ACK, RECV_FIN, SEND_ACK, CLOSED };
+/**
+ * A range of segments [start, end) the receiver is holding on to past the
+ * cumulative ack number. Carried (in network byte order) as the payload of an
+ * ACK with RDT_FLAG_SACK set.
+ */
+struct RDTSackBlock {
+	uint32_t 		start;
+	uint32_t 		end;
+};
+
+/**
+ * A received segment's data, lent to the application by receive_view. The
+ * data lives in one of the socket's receive buffers and stays valid until the
+ * view is given back with release_view.
+ */
+struct RDTRecvView {
+	const char 		*data;
+	int 			length; 	// 0 when the connection is closing, -1 on error
+	int 			buffer_id; 	// receive buffer holding the data (-1 if none)
+};
+
+/**
+ * Connection states.
+ *
+ * LISTEN: 		accept_connection is waiting for a SYN
+ * SYN: 		sent a SYN, waiting for the SYNACK
+ * SYN_ACK: 	sent a SYNACK, waiting for the ACK (or the first data)
+ * FIN_STATE: 	the remote host sent a FIN (which we FINACKed)
+ * RECV_ACK: 	sent a FIN, waiting for its FINACK
+ * RECV_FIN: 	our FIN was FINACKed, waiting for the remote host's FIN
+ * SEND_ACK: 	FINACKed the remote host's FIN, lingering in case it comes again
+ * LAST_ACK: 	sent a FIN after the remote host's, waiting for its FINACK
+ */
+enum connection_status { INIT, LISTEN, SYN, SYN_ACK, ACK_EST, ESTABLISHED, FIN_STATE, RECV_ACK, RECV_FIN, SEND_ACK, LAST_ACK, CLOSED };
+
+class RDTReactor;
+class RDTListener;
+
+// Maximum number of pieces the data of a single segment can be split into
+static const int MAX_PAYLOAD_IOVS = DatagramIO::MAX_DATAGRAM_IOVS - 1;
+
+/**
+ * A data segment that has been sent but not yet acknowledged. The sender keeps
+ * these around (keyed by sequence number) so they can be retransmitted.
+ *
+ * The header and the data are kept apart and sent with a single gather
+ * write. The data is either our own copy (in a buffer from the socket's
+ * segment pool) or still sitting in the application's buffers; payload points
+ * at wherever it is.
+ */
+struct RDTSentSegment {
+	RDTHeader 			header;
+	int 				buffer_id; 		// pool buffer with our copy (-1 if none)
+	struct iovec 		payload[MAX_PAYLOAD_IOVS];
+	int 				payload_iovcnt;
+	uint64_t 			last_sent; 		// time of last transmission (us)
+	int 				transmissions; 	// number of times it was sent
+	bool 				sacked; 		// receiver reported it in a SACK block
+};
+
+/**
+ * What the receiver has of a block of segments protected by an RDT_FEC
+ * repair segment: the XOR of the data and of the lengths of everything of
+ * the block received so far, the repair segment included. Once that is all
+ * but one of the block's data segments, the XOR is the missing one.
+ */
+struct RDTFecBlock {
+	int 				buffer_id; 		// pool buffer with the XOR of the data
+	uint32_t 			length_xor;
+	uint64_t 			received; 		// bit i: the block's i-th data segment
+	uint32_t 			num_segments; 	// in the block (0 until the repair arrives)
+};
 
 /**
  * Class that represents a socket using a reliable data transport protocol.
- * This socket uses a stop-and-wait protocol so your data is sent at a nice,
- * leisurely pace.
+ * This socket uses a selective repeat protocol: up to window_size segments may
+ * be in flight at once, the receiver buffers segments that arrive out of
+ * order, and the sender retransmits the oldest unacknowledged segment each
+ * time its retransmission timer expires.
  */
 class ReliableSocket {
 public:
-	/*
-	 * You probably shouldn't add any more public members to this class.
-	 * Any new functions or fields you need to add should be private.
-	 */
-	
-	// These are constants for all reliable connections
-	static const int MAX_SEG_SIZE  = 1400;
-	static const int MAX_DATA_SIZE = MAX_SEG_SIZE - sizeof(RDTHeader);
+	// These are constants for all reliable connections. Segment sizes
+	// include the header; each connection uses DEFAULT_SEG_SIZE unless both
+	// ends agree on another size (see set_max_segment_size), up to
+	// MAX_SEG_SIZE (the largest UDP datagram).
+	static const int DEFAULT_SEG_SIZE 	= 1400;
+	static const int MIN_SEG_SIZE 		= 512;
+	static const int MAX_SEG_SIZE 		= 65507;
+	static const int MAX_DATA_SIZE 		= MAX_SEG_SIZE - sizeof(RDTHeader);
+
+	// Default number of unacknowledged segments allowed in flight
+	static const uint32_t DEFAULT_WINDOW_SIZE = 64;
+
+	// Default number of duplicate ACKs that trigger a fast retransmit
+	static const uint32_t DEFAULT_DUP_ACK_THRESHOLD = 3;
+
+	// Most data segments a single FEC repair segment covers
+	static const uint32_t MAX_FEC_BLOCK_SIZE = 64;
 
 	/**
-	 * Basic Constructor, setting estimated RTT to 100 and deviation RTT to 10.
+	 * Basic Constructor, setting estimated RTT to 100 ms and deviation RTT to
+	 * 10 ms. The socket sends and receives through a UDP socket of its own.
 	 */
 	ReliableSocket();
 
+	/**
+	 * Creates a socket that sends and receives through the given transport
+	 * instead, e.g. an endpoint of a SimulatedNetwork.
+	 *
+	 * @note Only a transport with a file descriptor (see get_fd) can be used
+	 * with an RDTReactor.
+	 *
+	 * @param transport The transport. The socket takes ownership of it.
+	 */
+	explicit ReliableSocket(DatagramTransport *transport);
+
+	/**
+	 * Detaches the socket from its reactor and listener (if any).
+	 *
+	 * @note This doesn't close the connection: call close_connection first.
+	 */
+	~ReliableSocket();
+
 	/**
 	 * Connects to the specified remote hostname on the given port.
 	 *
+	 * @note In non-blocking mode this only sends the SYN; the connection is
+	 * established once the SYNACK comes in.
+	 *
 	 * @param hostname Name of the remote host to connect to.
 	 * @param port_num Port number of remote host.
 	 */
@@ -51,31 +238,122 @@ public:
 	/**
 	 * Waits for a connection attempt from a remote host.
 	 *
+	 * @note In non-blocking mode this only binds the port; the connection is
+	 * established once a SYN (and then our SYNACK's ACK) comes in. If the
+	 * ACK never does (see MAX_SYNACK_TRANSMISSIONS), the socket is CLOSED.
+	 *
 	 * @param port_num The port number to listen on.
 	 */
 	void accept_connection(int port_num);
 
 	/**
-	 * Send data to connected remote host.
+	 * Send data to connected remote host. The data can be any length: it is
+	 * split into segments of the size agreed on when connecting (or, with
+	 * path MTU probing, the largest found to get through so far; see
+	 * get_segment_size), each with its own copy of its part of the data.
+	 *
+	 * @note This returns as soon as the last segment is in the send window; it
+	 * only blocks (waiting for ACKs) while the window is full. In non-blocking
+	 * mode it takes as many segments as fit in the window and never blocks.
 	 *
 	 * @param buffer The buffer with data to be sent.
 	 * @param length The amount of data in the buffer to send.
+	 * @return The number of bytes taken (length, unless in non-blocking mode),
+	 * or -1 with errno set to EAGAIN if the window is full or ENOTCONN if the
+	 * connection isn't established.
 	 */
-	void send_data(const void *buffer, int length);
+	int send_data(const void *buffer, int length);
+
+	/**
+	 * Send data, gathered from several buffers, to connected remote host.
+	 * The data is split into segments that point straight into the buffers,
+	 * so it is never copied on its way to the kernel.
+	 *
+	 * @note Because the buffers are used for retransmissions, this blocks
+	 * until all of the data has been acknowledged, so it can't be used in
+	 * non-blocking mode.
+	 *
+	 * @param iov The buffers with the data to be sent.
+	 * @param iovcnt Number of buffers.
+	 */
+	void send_data(const struct iovec *iov, int iovcnt);
 
 	/**
 	 * Receives data from remote host using a reliable connection.
 	 *
-	 * @param buffer The buffer where received data will be stored.
+	 * @param buffer The buffer where received data will be stored (with
+	 * room for the data of the largest segment).
 	 * @return The amount of data actually received.
 	 */
 	int receive_data(char buffer[MAX_DATA_SIZE]);
 
+	/**
+	 * Receives data from remote host without copying it: the returned view
+	 * points straight into the buffer the segment was received into.
+	 *
+	 * @note Every view must be given back with release_view, otherwise its
+	 * buffer can't be reused.
+	 *
+	 * @return View of the received data. Its length is 0 once the remote host
+	 * closes the connection and -1 if the connection isn't established (or,
+	 * in non-blocking mode, with errno set to EAGAIN if nothing is ready yet).
+	 */
+	RDTRecvView receive_view();
+
+	/**
+	 * Gives a view from receive_view back to the socket.
+	 *
+	 * @param view The view to release.
+	 */
+	void release_view(const RDTRecvView &view);
+
+	/**
+	 * Sends the contents of a file, from its current offset to its end, to
+	 * connected remote host. A regular file is memory-mapped and segments
+	 * point straight into the mapping, so its data is never copied on its
+	 * way to the kernel. Anything else (e.g. a pipe) is read in chunks.
+	 *
+	 * @note Like send_data with borrowed buffers, this blocks until all of
+	 * the data has been acknowledged, so it can't be used in non-blocking
+	 * mode.
+	 *
+	 * @param fd The file descriptor to read from.
+	 * @return The number of bytes sent, or -1 (with errno set) if the file
+	 * couldn't be read or the connection isn't established.
+	 */
+	int64_t send_file(int fd);
+
+	/**
+	 * Receives everything the remote host sends until it closes the
+	 * connection, and writes it to a file. Every run of segments that is
+	 * ready in order goes out in a single gather write, straight from the
+	 * buffers the segments were received into.
+	 *
+	 * @note This can't be used in non-blocking mode.
+	 *
+	 * @param fd The file descriptor to write to.
+	 * @return The number of bytes received, or -1 (with errno set) if
+	 * writing failed or the connection isn't established.
+	 */
+	int64_t receive_file(int fd);
+
 	/**
 	 * Closes an connection.
+	 *
+	 * @note In non-blocking mode this only starts closing (after the send
+	 * window has drained); the socket is done once its state is CLOSED.
 	 */
 	void close_connection();
 
+	/**
+	 * Turns non-blocking mode on or off. In non-blocking mode no call waits
+	 * for the network: the socket has to be driven by an RDTReactor (which
+	 * turns this on when the socket is added to it).
+	 *
+	 * @param enabled Whether to use non-blocking mode.
+	 */
+	void set_nonblocking(bool enabled);
+
 	/**
 	 * Returns the estimated RTT.
 	 * 
@@ -83,73 +361,789 @@ public:
 	 */
 	uint32_t get_estimated_rtt();
 
+	/**
+	 * Returns the estimated RTT with full precision.
+	 *
+	 * @return Estimated RTT for connection (in microseconds)
+	 */
+	uint32_t get_estimated_rtt_us();
+
+	/**
+	 * Sets the lower bound on the retransmission timeout (10 ms by default).
+	 *
+	 * @note Timers fire with millisecond precision, so timeouts below 1 ms
+	 * are rounded up to it.
+	 *
+	 * @param usec The minimum timeout in microseconds.
+	 */
+	void set_min_timeout(uint32_t usec);
+
+	/**
+	 * Returns counters for the batched datagram I/O, e.g. to check how many
+	 * packets each send/receive syscall handled, or that a long transfer's
+	 * heap_allocations stop going up once its window has opened.
+	 *
+	 * @return The I/O counters.
+	 */
+	RDTIOStats get_io_stats();
+
+	/**
+	 * Returns a snapshot of the connection's statistics: segment, ACK and
+	 * timeout counters, bytes in flight, goodput and an RTT histogram.
+	 *
+	 * @note Unlike the rest of the API this may be called from any thread,
+	 * even while another one is using the socket.
+	 *
+	 * @return The statistics.
+	 */
+	RDTStats get_stats();
+
+	/**
+	 * Turns on UDP GSO/GRO offload, where the kernel supports it: batches of
+	 * segments are passed to and from the kernel as single large buffers that
+	 * it splits/merges at segment boundaries. Falls back to normal sends and
+	 * receives otherwise. Must be called before connecting.
+	 *
+	 * @param enabled Whether to use offload.
+	 * @return True if GSO and/or GRO is actually in use.
+	 */
+	bool set_offload_enabled(bool enabled);
+
+	/**
+	 * Sets the maximum number of unacknowledged segments in flight.
+	 *
+	 * @param num_segments Size of the send window (at least 1).
+	 */
+	void set_window_size(uint32_t num_segments);
+
+	/**
+	 * Turns selective acknowledgments on or off (they are on by default).
+	 * Must be called before connect_to_remote to have any effect.
+	 *
+	 * @param enabled Whether to ask the receiver for SACK blocks.
+	 */
+	void set_sack_enabled(bool enabled);
+
+	/**
+	 * Sets how many duplicate ACKs make the sender resend the segment they
+	 * are missing right away (fast retransmit) instead of waiting for the
+	 * retransmission timer. The default is 3.
+	 *
+	 * @param num_dup_acks The number of duplicate ACKs (0 to turn fast
+	 * retransmit off).
+	 */
+	void set_dup_ack_threshold(uint32_t num_dup_acks);
+
+	/**
+	 * Sets the largest segment (header included) this end sends or
+	 * receives, DEFAULT_SEG_SIZE by default. When connecting, the two ends
+	 * agree on the smaller of their sizes. Larger segments cut the cost per
+	 * byte, e.g. up to MAX_SEG_SIZE on loopback or about 9000 bytes with
+	 * jumbo frames. Must be called before connecting.
+	 *
+	 * @param bytes The segment size (MIN_SEG_SIZE to MAX_SEG_SIZE).
+	 */
+	void set_max_segment_size(int bytes);
+
+	/**
+	 * Returns the size of the data segments we send (header included): the
+	 * size agreed on when connecting, or with path MTU probing, the largest
+	 * size found to get through so far.
+	 */
+	int get_segment_size();
+
+	/**
+	 * Turns path MTU probing on or off (it is off by default). Data then
+	 * starts out in segments of at most DEFAULT_SEG_SIZE bytes, while padded
+	 * probes look for the largest size, up to the agreed one, that gets
+	 * through without being fragmented. A probe that is lost three times
+	 * makes the search fall back to smaller sizes. If segments of the size
+	 * found later stop getting through (see MAX_LARGE_SEGMENT_TIMEOUTS),
+	 * data goes back to DEFAULT_SEG_SIZE and the search starts over. Must be
+	 * called before connecting.
+	 *
+	 * @param enabled Whether to probe.
+	 */
+	void set_pmtu_probing(bool enabled);
+
+	/**
+	 * Turns on forward error correction for the data we send: every
+	 * num_segments data segments are followed by a repair segment holding
+	 * the XOR of their data, from which the receiver rebuilds any one of them
+	 * that was lost without waiting for it to be resent. That costs one
+	 * segment in every num_segments + 1, so smaller blocks recover more
+	 * losses for more overhead. Must be called before connecting.
+	 *
+	 * @param num_segments Data segments per repair segment (at most
+	 * MAX_FEC_BLOCK_SIZE), or 0 to turn it off (the default).
+	 */
+	void set_fec_block_size(uint32_t num_segments);
+
+	/**
+	 * Chooses the congestion control algorithm used when sending (Reno by
+	 * default). The new controller starts from its initial window.
+	 *
+	 * @note Only if the library was built to pick it at run time (see
+	 * RDTPolicy.h); otherwise this does nothing.
+	 *
+	 * @param algorithm The algorithm to use.
+	 */
+	void set_congestion_control(RDTCongestionAlgorithm algorithm);
+
 private:
+	// The reactor drives non-blocking sockets through the private interface,
+	// and a listener creates and feeds the connections it accepts
+	friend class RDTReactor;
+	friend class RDTListener;
+
 	// Private member variables are initialized in the constructor
-	int 				sock_fd;
+	// What segments go through: our own transport, or our listener's
+	DatagramTransport 	*transport;
+	std::unique_ptr<DatagramTransport> owned_transport; 	// NULL if the listener's
 	uint32_t 			sequence_number;
 	uint32_t 			expected_sequence_number;
-	float 				estimated_rtt;
-	float 				dev_rtt;
-	int					curr_rtt;
+	float 				estimated_rtt; 	// us
+	float 				dev_rtt; 		// us
+	int					curr_rtt; 		// us
 	connection_status 	state;
 
 	// In the (unlikely?) event you need a new field, add it here.
+	static const uint32_t DEFAULT_MIN_TIMEOUT_US = 10000;
 
-	/**
-	 * Sets the timeout length of this connection.
-	 *
-	 * @note Setting this to 0 makes the timeout length indefinite (i.e. could
-	 * wait forever for a message).
-	 *
-	 * @param timeout_length_ms Length of timeout period in milliseconds.
-	 */
-	void set_timeout_length(uint32_t timeout_length_ms);
+	// Maximum number of SACK blocks carried in a single ACK
+	static const int MAX_SACK_BLOCKS = 8;
+
+	// Maximum number of out of order segments the receiver will hold on to
+	static const uint32_t REASSEMBLY_BUFFER_SIZE = 4 * DEFAULT_WINDOW_SIZE;
+
+	// How long we linger after FINACKing the remote host's FIN (ms)
+	static const int TIME_WAIT_MS = 500;
+
+	// Number of times we send a FIN before giving up on the remote host
+	static const int MAX_FIN_TRANSMISSIONS = 10;
+
+	// Number of times we send a SYNACK before giving up on the remote host
+	// (e.g. one that went away, or a stray or spoofed SYN)
+	static const int MAX_SYNACK_TRANSMISSIONS = 10;
+
+	// Number of times a path MTU probe is sent before we decide that size
+	// doesn't get through
+	static const int MAX_PROBE_TRANSMISSIONS = 3;
+
+	// Path MTU probing stops once the sizes left to try are this close
+	static const int PROBE_GRANULARITY = 64;
+
+	// Number of retransmission timeouts in a row, with the oldest segment
+	// larger than DEFAULT_SEG_SIZE, after which we take it that the path no
+	// longer carries segments that large
+	static const uint32_t MAX_LARGE_SEGMENT_TIMEOUTS = 3;
+
+	// Bytes of IPv4 and UDP header in front of each segment
+	static const int IP_UDP_HEADER_SIZE = 28;
+
+	// Roughly what the kernel's bookkeeping for each datagram waiting in a
+	// socket's receive buffer takes out of it
+	static const int RECV_BUFFER_OVERHEAD = 1024;
+
+	// send_file queues a mapped file this much at a time, and reads files
+	// that can't be mapped this much at a time
+	static const size_t FILE_MAP_CHUNK_SIZE 	= 64 << 20;
+	static const size_t FILE_READ_CHUNK_SIZE 	= 1 << 20;
+
+	// Most segments receive_file writes out in one go
+	static const int FILE_WRITE_BATCH = 64;
+
+	uint32_t 			window_size;
+
+	// Lower bound on retransmit_timeout (us)
+	uint32_t 			min_timeout_us;
+
+	// Timestamp of the last segment from the remote host, echoed in
+	// everything we send (see RDTHeader)
+	uint32_t 			echo_timestamp;
+
+	// Retransmission queue: sent but unacknowledged segments by sequence num
+	SequenceRing<RDTSentSegment> unacked_segments;
+
+	// Start of the current retransmission timeout period (us). While we wait
+	// for a SYNACK, ACK or FINACK it times the SYN, SYNACK or FIN instead.
+	uint64_t 			retransmit_timer_start;
+
+	// Number of times the SYN, SYNACK or FIN we're waiting on was sent
+	int 				control_transmissions;
+
+	// Fast retransmit: duplicate ACKs in a row, and how many trigger it
+	uint32_t 			dup_acks;
+	uint32_t 			dup_ack_threshold;
+
+	// Fast recovery (after a fast retransmit, until everything that was in
+	// flight then has been ACKed): the first sequence number past that, and
+	// how many extra segments the duplicate ACKs since have let us send
+	bool 				in_recovery;
+	uint32_t 			recovery_point;
+	uint32_t 			recovery_inflation;
+
+	// When we entered fast recovery (us), and whether the first ACK for the
+	// resent segment may still show (by echoing an earlier timestamp) that
+	// the original had arrived after all
+	uint64_t 			recovery_start;
+	bool 				recovery_undo_possible;
+
+	// Segment sizes (header included): the largest we take, the largest both
+	// ends agreed on, and the one new data segments are cut to
+	int 				max_seg_size;
+	int 				seg_size_limit;
+	int 				seg_size;
+
+	// Path MTU probing: the size being probed (0 if none), the largest size
+	// not known to fail, and when and how often the probe was sent
+	bool 				pmtu_probing;
+	int 				probe_size;
+	int 				probe_ceiling;
+	uint64_t 			probe_sent; 	// us
+	int 				probe_transmissions;
+	RDTHeader 			probe_header;
+
+	// Retransmission timeouts since the window last moved
+	uint32_t 			consecutive_timeouts;
+
+	// After falling back from a segment size that stopped getting through:
+	// segments may be fragmented on the way (so those already cut to that
+	// size get through too) until every one before fragment_until is ACKed
+	bool 				fragmenting;
+	uint32_t 			fragment_until;
+
+	// Flow control: the first sequence number the remote host has no room
+	// for, the one we last told it we have no room for, and whether sending
+	// is held up for lack of room (so the window must be probed if the ACKs
+	// stop coming)
+	uint32_t 			peer_window_edge;
+	uint32_t 			advertised_window_edge;
+	bool 				send_stalled;
+
+	// How many segments the socket's receive buffer holds: segments past
+	// expected_sequence_number wait there until we get to them, so the
+	// window is never larger
+	uint32_t 			recv_buffer_segments;
+
+	// Forward error correction. Blocks are aligned on sequence numbers: with
+	// n segments per block, block b is segments b * n to b * n + n - 1.
+	// Sending: the segment_pool buffer holding the RDT_FEC segment for the
+	// current block, whose payload is built up as its data segments are
+	// sent, the longest of them and the XOR of their lengths. Repair
+	// segments are sent straight from their buffers, which are given back
+	// once they have gone out (with the next ACK that frees segments).
+	uint32_t 			fec_block_size;
+	int 				fec_buffer_id;
+	int 				fec_length;
+	uint32_t 			fec_length_xor;
+	std::vector<int> 	fec_sent_buffers;
+
+	// Receiving: the remote host's block size (0 if it sends no repair
+	// segments), and the blocks not yet complete by block number (first
+	// sequence number / block size)
+	uint32_t 			peer_fec_block_size;
+	SequenceRing<RDTFecBlock> fec_blocks;
+
+	// Whether calls return instead of waiting for the network
+	bool 				nonblocking;
+
+	// close_connection was called in non-blocking mode while data was still
+	// in flight; the FIN goes out once it has all been acknowledged
+	bool 				close_pending;
+
+	// The reactor driving this socket (NULL if none)
+	RDTReactor 			*reactor;
+
+	// Our next deadline (see next_timeout) on the wheel of whoever drives us:
+	// the reactor, or the listener in blocking mode (NULL if neither)
+	RDTTimer 			timer;
+	TimerWheel 			*timer_wheel;
+
+	// Identifies this connection in every segment (see RDTHeader)
+	uint16_t 			connection_id;
+
+	// For connections accepted by a listener: the listener, which owns the
+	// transport and receives for us, and the remote host's address. NULL (and
+	// unused) for sockets that have a transport to themselves.
+	RDTListener 		*listener;
+	struct sockaddr_in 	peer_addr;
+
+	// Whoever received the segments we hold on to: our io, or the listener's
+	DatagramIO 			*recv_io;
+
+	// Whether we ask for (sender) or send (receiver) selective ACKs
+	bool 				sack_enabled;
+
+	// Whether the other end said (with RDT_FLAG_CHECKSUM) that it checksums
+	// its segments, so that we must check them
+	bool 				peer_checksums;
+
+	// Counters for get_stats
+	RDTStatCounters 	stats;
+
+	// Decides how many segments can be in flight (along with window_size)
+	RDTCongestionPolicy congestion_control;
+
+	// Batched sends (data and ACKs) and receives on the transport
+	DatagramIO 			io;
+
+	// Buffers of seg_size_limit bytes: the copies of the data we send (see
+	// RDTSentSegment), the repair segments we send and the parity of the FEC
+	// blocks we receive. Like the receive buffers, they are only allocated
+	// while the window opens up and then recycled.
+	BufferPool 			segment_pool;
+
+	// Reassembly buffer: received data waiting to be handed to receive_view,
+	// by sequence number. Each entry holds a reference on its receive buffer.
+	// On the receiving side sequence_number is the next segment to deliver
+	// and expected_sequence_number is the first one we haven't received yet.
+	SequenceRing<RDTRecvView> reassembly_buffer;
 
 	/*
 	 * Add new member functions (i.e. methods) after this point.
 	 * Remember that only the comment and header line goes here. The
 	 * implementation should be in the .cpp file.
 	 */
-	bool receiver_handshake(char received_segment[MAX_SEG_SIZE]);
+	/*
+	 * Creates a connection accepted by a listener. It sends through the
+	 * listener's transport and is fed segments by the listener.
+	 *
+	 * @param listener The listener.
+	 * @param peer_addr Address of the remote host.
+	 */
+	ReliableSocket(RDTListener *listener, const struct sockaddr_in *peer_addr);
+
+	/*
+	 * Sets the fields every socket starts with and attaches io to the
+	 * transport.
+	 *
+	 * @param send_only Whether someone else (a listener) receives for us.
+	 */
+	void init(bool send_only);
+
+	/*
+	 * The receiver part of opening a connection: answers the remote host's
+	 * SYN with a SYNACK and waits for the ACK in state SYN_ACK.
+	 *
+	 * @param syn Header of the SYN.
+	 * @param length Length of the SYN.
+	 */
+	void receiver_handshake(const RDTHeader *syn, int length);
+
+	/*
+	 * Agrees on the segment size with the remote host, and takes note of
+	 * its FEC block size, from the options in its SYN or SYNACK.
+	 *
+	 * @param hdr Header of the SYN or SYNACK.
+	 * @param length Length of the segment.
+	 */
+	void negotiate_segment_size(const RDTHeader *hdr, int length);
+
+	/*
+	 * Starts probing whether segments of the given size get through, unless
+	 * the size is too close to the one we already use to be worth it.
+	 *
+	 * @param size The segment size to try.
+	 */
+	void send_probe(int size);
+
+	/*
+	 * Queues the current path MTU probe (again).
+	 */
+	void transmit_probe();
+
+	/*
+	 * Handles the answer to a path MTU probe: segments of that size get
+	 * through, so data is sent in them from now on.
+	 *
+	 * @param size The size of the probe that was answered.
+	 */
+	void handle_probe_ack(uint32_t size);
+
+	/*
+	 * Gives up on a segment size that has stopped getting through (e.g. the
+	 * path changed, or drops what is too big without a word): new data goes
+	 * out in DEFAULT_SEG_SIZE segments, those still in flight may be
+	 * fragmented, and probing starts over once they are through.
+	 *
+	 * @param failed_size Size of the segment that didn't get through.
+	 */
+	void fall_back_segment_size(int failed_size);
+
+	/*
+	 * Lets the segments we send be fragmented on the way (or stops it, so
+	 * that path MTU probes are dropped if they're too big again).
+	 *
+	 * @param enabled Whether to allow fragmenting.
+	 */
+	void set_fragmenting(bool enabled);
 	
 	/*
-	 * The sender handshake part of opening up an intial connectioin, needed
-	 * to 
+	 * The sender part of opening a connection: sends the SYN and waits for
+	 * the SYNACK in state SYN.
+	 */
+	void sender_handshake();
+
+	/*
+	 * Finishes either side of the handshake: takes an RTT sample from the
+	 * timestamp the remote host echoed and moves to ESTABLISHED.
 	 *
+	 * @param hdr Header of the segment that completed the handshake.
 	 */
-	bool sender_handshake();
+	void establish_connection(const RDTHeader *hdr);
 	
 	/*
 	 * Updates the estimated_rtt by updating it with a new value
 	 *
 	 */ 
 	void set_estimated_rtt();
-	
+
+	/*
+	 * Takes an RTT sample from the timestamp echoed in a segment's header.
+	 *
+	 * @param hdr The header.
+	 * @return The sample (us), or -1 if the header didn't echo a timestamp.
+	 */
+	int sample_rtt(const RDTHeader *hdr);
+
+	/*
+	 * Fills in the timestamp and timestamp_echo of a header that is about to
+	 * be sent.
+	 *
+	 * @param hdr The header.
+	 */
+	void stamp_header(RDTHeader *hdr);
+
+	/*
+	 * Fills in the checksum of a segment that is about to be sent. Every
+	 * other field of the header must have been filled in already.
+	 *
+	 * @param hdr The header.
+	 * @param payload The payload (in pieces).
+	 * @param iovcnt Number of pieces.
+	 */
+	static void set_checksum(RDTHeader *hdr, const struct iovec *payload, int iovcnt);
+
+	/*
+	 * Checks the checksum of a received segment. Segments from an end that
+	 * doesn't checksum aren't checked, but one that does (as a SYN or SYNACK
+	 * with RDT_FLAG_CHECKSUM says for itself) must carry a matching sum.
+	 *
+	 * @param segment The segment (at least a header long).
+	 * @param length Length of the segment.
+	 * @param peer_checksums Whether the sender said it checksums its segments.
+	 * @return true if it passes, false if the segment was corrupted.
+	 */
+	static bool checksum_ok(const char *segment, int length, bool peer_checksums);
+
+	/*
+	 * Queues a control segment of the given type (SYN, SYNACK, ACK, FIN,
+	 * FINACK or PROBEACK) to be sent. The SYN and SYNACK carry our
+	 * RDTSynOptions; the rest are just a header.
+	 *
+	 * @param type The type of segment.
+	 * @param ack_number The ack number to send.
+	 */
+	void send_control(RDTMessageType type, uint32_t ack_number = 0);
+
+	/*
+	 * Sends anything queued, then waits for segments to arrive (or until the
+	 * next timer expires) and handles them. This is what every blocking call
+	 * loops on.
+	 */
+	void wait_for_events();
+
+	/*
+	 * Waits for a SYN on an unconnected socket (in state LISTEN), connects
+	 * the socket to whoever sent it and starts the handshake.
+	 *
+	 * @return False if nothing was received (a timeout, or EAGAIN).
+	 */
+	bool listen_for_syn();
+
+	/*
+	 * Receives a batch of segments and handles every segment in it.
+	 *
+	 * @return False if nothing was received (a timeout, or EAGAIN).
+	 */
+	bool receive_segments();
+
+	/*
+	 * Handles a single received segment according to the connection state.
+	 *
+	 * @param segment The received segment.
+	 * @param length Length of the received segment.
+	 * @param buffer_id Receive buffer holding the segment.
+	 */
+	void process_segment(char *segment, int length, int buffer_id);
+
+	/*
+	 * Sends the RDT_FEC segment for the data segments sent since the last
+	 * one, and starts on the next block.
+	 */
+	void send_fec();
+
+	/*
+	 * Adds a newly received data segment to its FEC block, rebuilding the
+	 * block's missing segment if that leaves just one.
+	 *
+	 * @param seq_num Sequence number of the segment.
+	 * @param data The segment's payload.
+	 */
+	void fec_add_data(uint32_t seq_num, const RDTRecvView &data);
+
+	/*
+	 * Adds a received RDT_FEC segment to its block, rebuilding the block's
+	 * missing segment if just one is.
+	 *
+	 * @param hdr Header of the segment.
+	 * @param parity The segment's payload.
+	 * @param length Length of the payload.
+	 * @return true if a segment was rebuilt.
+	 */
+	bool fec_add_repair(const RDTHeader *hdr, const char *parity, int length);
+
+	/*
+	 * Returns the FEC block starting at a sequence number, starting on it
+	 * (with a zeroed parity buffer) if it is new.
+	 *
+	 * @param first Sequence number of the block's first segment.
+	 * @return The block.
+	 */
+	RDTFecBlock &fec_block(uint32_t first);
+
 	/*
-	 * Sends a segment with header and waits to receive something back or
-	 * indicates a time out 
+	 * Forgets an FEC block, giving back its parity buffer.
 	 *
-	 * @param send_segment The char array that is being sent to the receiver
-	 * @param send_seg_size The specified segment size to be sent 
-	 * @param recv_segment The receive char array that will receive from the
-	 * 					   sender
-	 * @return True if send and wait worked, False if a timeout occured
+	 * @param first Sequence number of the block's first segment.
+	 */
+	void fec_forget(uint32_t first);
+
+	/*
+	 * Rebuilds the missing segment of an FEC block if we have everything else
+	 * of it, and forgets the block once it is complete.
 	 *
+	 * @param first Sequence number of the block's first segment.
+	 * @return true if a segment was rebuilt.
 	 */
-	bool send_and_wait(char send_segment[], int send_seg_size, char *recv_segment); 
+	bool fec_recover(uint32_t first);
 
-	bool send_and_timeout(char send_segment[], int seg_size);
+	/*
+	 * Handles a received FIN according to the connection state.
+	 */
+	void process_fin();
 
 	/*
-	 * The sender part of closing the connection between sender and receiver
+	 * Handles a received data segment: buffers the data until it can be
+	 * delivered in order and queues an ACK for it.
 	 *
+	 * @param hdr Header of the received segment.
+	 * @param data The segment's payload.
 	 */
-	void sender_close_handshake();
+	void process_data(const RDTHeader *hdr, const RDTRecvView &data);
 
 	/*
-	 * The receiver part of closing the connection between the sender and
-	 * receiver
+	 * Does whatever is due because a timer ran out: resending a SYN, SYNACK,
+	 * FIN or data, or finishing the linger after the last FINACK.
+	 */
+	void process_timeouts();
+
+	/*
+	 * Returns the time until process_timeouts next has something to do.
 	 *
+	 * @return Time left in microseconds (0 if overdue), or -1 if no timer is
+	 * running.
+	 */
+	int64_t next_timeout();
+
+	/*
+	 * Returns true if receive_view would return without waiting.
+	 */
+	bool is_readable();
+
+	/*
+	 * Returns true if send_data would take at least one segment without
+	 * waiting.
+	 */
+	bool is_writable();
+
+	/*
+	 * Moves our timer on timer_wheel (if any) to the deadline from
+	 * next_timeout. Called whenever the deadline may have changed.
+	 */
+	void update_timer();
+
+	/*
+	 * Returns the current retransmission timeout (estimated_rtt + 4*dev_rtt)
+	 * in microseconds, never less than min_timeout_us.
+	 */
+	uint32_t retransmit_timeout();
+
+	/*
+	 * Returns the number of segments we may currently have in flight: the
+	 * smaller of window_size and the congestion window.
 	 */
-	void receiver_close_handshake();
+	uint32_t send_window();
+
+	/*
+	 * The part of send_file for files that can't be memory-mapped: reads the
+	 * file a chunk at a time and sends copies of the chunks.
+	 *
+	 * @param fd The file descriptor to read from.
+	 * @return The number of bytes sent, or -1 if the file couldn't be read.
+	 */
+	int64_t send_file_chunks(int fd);
+
+	/*
+	 * Cuts buffers of any length into segments of at most seg_size bytes
+	 * (header included) and adds them to the send window with
+	 * queue_new_segment.
+	 *
+	 * @param iov The buffers with the data.
+	 * @param iovcnt Number of buffers.
+	 * @param copy Whether the segments get their own copies of the data.
+	 * @return The number of bytes queued (less than the total only in
+	 * non-blocking mode, when the window fills up).
+	 */
+	int queue_segments(const struct iovec *iov, int iovcnt, bool copy);
+
+	/*
+	 * Adds a new data segment to the send window (waiting for room first,
+	 * unless in non-blocking mode) and queues it to be sent.
+	 *
+	 * @param payload The pieces of the segment's data.
+	 * @param iovcnt Number of pieces (at most MAX_PAYLOAD_IOVS).
+	 * @param copy If true, the data is copied into the segment; otherwise the
+	 * caller must keep it around until the segment is acknowledged.
+	 * @return False if there was no room in the window.
+	 */
+	bool queue_new_segment(const struct iovec *payload, int iovcnt, bool copy);
+
+	/*
+	 * Queues a segment from the retransmission queue to be (re)sent, as the
+	 * header followed by the pieces of its data.
+	 *
+	 * @param sent The segment to send.
+	 */
+	void queue_segment(RDTSentSegment &sent);
+
+	/*
+	 * Handles a received ACK (and any SACK blocks it carries).
+	 *
+	 * @param recv_segment The received segment.
+	 * @param recv_count Length of the received segment.
+	 * @param window_moved Whether the ACK moved the receiver's window (see
+	 * update_peer_window). Without SACK, such an ACK isn't a duplicate.
+	 */
+	void process_ack(char *recv_segment, int recv_count, bool window_moved);
+
+	/*
+	 * Takes note of the remote host's receive window from a segment.
+	 *
+	 * @param hdr Header of the segment (an ACK, SYN or SYNACK).
+	 * @return true if the right edge of the window moved forward.
+	 */
+	bool update_peer_window(const RDTHeader *hdr);
+
+	/*
+	 * Returns how many segments past expected_sequence_number we have room
+	 * for: in the reassembly buffer, and on the way there, in the socket's
+	 * receive buffer.
+	 */
+	uint32_t receive_window();
+
+	/*
+	 * Works out recv_buffer_segments for the current segment size.
+	 */
+	void measure_receive_buffer();
+
+	/*
+	 * Slides the send window forward for a cumulative ACK, i.e. removes every
+	 * segment with a sequence number less than ack_number from the
+	 * retransmission queue.
+	 *
+	 * @param ack_number The next sequence number expected by the receiver.
+	 * @param rtt_sample RTT sample taken from the ACK (us), or -1 if none.
+	 * @param new_sacks Whether the ACK's SACK blocks reported segments we
+	 * didn't know had arrived. With SACK, a duplicate ACK that doesn't (e.g.
+	 * one for a duplicated segment) isn't a sign of loss.
+	 */
+	void handle_ack(uint32_t ack_number, int rtt_sample, bool new_sacks);
+
+	/*
+	 * Counts a duplicate ACK (one for the start of the send window). Enough
+	 * of them in a row mean that segment was lost: it is resent right away
+	 * and we enter fast recovery. In fast recovery each one means another
+	 * segment has left the network, so another may be sent.
+	 */
+	void handle_dup_ack();
+
+	/*
+	 * Resends the oldest unacknowledged segment without waiting for the
+	 * retransmission timer.
+	 */
+	void fast_retransmit();
+
+	/*
+	 * Marks the segments covered by the SACK blocks at the end of an ACK so
+	 * they are no longer retransmitted.
+	 *
+	 * @param blocks The SACK blocks (in network byte order).
+	 * @param num_blocks Number of blocks.
+	 * @return The number of segments that weren't marked yet.
+	 */
+	uint32_t handle_sack(const RDTSackBlock *blocks, int num_blocks);
+
+	/*
+	 * Resends the oldest unacknowledged segment, along with every other
+	 * segment the receiver's SACK blocks show to be missing, and restarts the
+	 * retransmission timer.
+	 */
+	void retransmit_oldest();
+
+	/*
+	 * Blocks until every segment in the send window has been acknowledged.
+	 */
+	void flush_send_window();
+
+	/*
+	 * Stores a received data segment in the reassembly buffer (if it is new and
+	 * fits) and advances expected_sequence_number past every segment we have
+	 * without a gap.
+	 *
+	 * @param seq_num Sequence number of the received segment.
+	 * @param view The segment's payload (retained if it is stored).
+	 * @return true if it was stored.
+	 */
+	bool buffer_received_data(uint32_t seq_num, const RDTRecvView &view);
+
+	/*
+	 * Queues an ACK for everything up to expected_sequence_number, with SACK
+	 * blocks for anything we have past it, and our receive window.
+	 *
+	 * @param seq_num Sequence number of the segment that prompted it.
+	 */
+	void send_ack(uint32_t seq_num);
+
+	/*
+	 * Describes the contents of the reassembly buffer as SACK blocks.
+	 *
+	 * @param blocks Where to put the blocks (in network byte order).
+	 * @return The number of blocks filled in (at most MAX_SACK_BLOCKS).
+	 */
+	int fill_sack_blocks(RDTSackBlock blocks[MAX_SACK_BLOCKS]);
+
+	/*
+	 * Starts closing the connection: sends our FIN, as the sender (in state
+	 * ESTABLISHED) or as the receiver (in FIN_STATE, after the sender's FIN).
+	 */
+	void start_close();
+
+	/*
+	 * Marks the connection CLOSED and closes the socket.
+	 */
+	void finish_close();
 };
+
+#endif
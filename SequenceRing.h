@@ -0,0 +1,274 @@
+/*
+ * File: SequenceRing.h
+ *
+ * Header / API file for the container the RDT library keeps per-segment state
+ * in (the retransmission queue, the reassembly buffer and the FEC blocks),
+ * indexed by sequence number.
+ *
+ * Entries live in a power-of-two array of slots, sequence number seq in slot
+ * seq & (capacity - 1), so the sequence numbers held at any one time must fit
+ * in a window as wide as the array. That suits a transport whose windows are
+ * bounded anyway: looking an entry up, adding one and taking one away are
+ * array accesses, with none of the per-entry heap allocation of a std::map.
+ *
+ * Taking an entry away leaves its value in the slot, so memory the value owns
+ * is reused by the next entry to land there. The array itself only grows
+ * (doubling) when the window gets wider than it, which moves every entry:
+ * pointers to entries are only good until an insert that doesn't fit.
+ *
+ */
+#ifndef SEQUENCE_RING_H
+#define SEQUENCE_RING_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SequenceRing {
+public:
+	SequenceRing();
+
+	SequenceRing(const SequenceRing&) = delete;
+	SequenceRing& operator=(const SequenceRing&) = delete;
+
+	/**
+	 * Makes room for a window of at least the given number of sequence
+	 * numbers, so entries spanning that many can be added without growing.
+	 *
+	 * @param capacity The width of the window.
+	 */
+	void reserve(uint32_t capacity);
+
+	/**
+	 * Returns true if there are no entries.
+	 */
+	bool empty() const;
+
+	/**
+	 * Returns the number of entries.
+	 */
+	uint32_t size() const;
+
+	/**
+	 * Returns the lowest sequence number with an entry. Only meaningful if
+	 * the ring isn't empty.
+	 */
+	uint32_t first() const;
+
+	/**
+	 * Returns one past the highest sequence number with an entry (first() if
+	 * the ring is empty). Every entry is in [first(), end()).
+	 */
+	uint32_t end() const;
+
+	/**
+	 * Returns the entry for a sequence number.
+	 *
+	 * @param seq The sequence number.
+	 * @return The entry, or NULL if there is none.
+	 */
+	T *find(uint32_t seq);
+
+	/**
+	 * Returns true if an entry for a sequence number can be added without
+	 * growing the ring (and so moving the entries).
+	 *
+	 * @param seq The sequence number.
+	 */
+	bool fits(uint32_t seq) const;
+
+	/**
+	 * Adds an entry for a sequence number (growing the ring if it would be
+	 * too wide otherwise).
+	 *
+	 * @param seq The sequence number.
+	 * @return The entry. If there already was one, that is returned;
+	 * otherwise it holds whatever the slot's last entry left behind.
+	 */
+	T &insert(uint32_t seq);
+
+	/**
+	 * Removes the entry for a sequence number, if there is one.
+	 *
+	 * @param seq The sequence number.
+	 */
+	void erase(uint32_t seq);
+
+	/**
+	 * Removes every entry.
+	 */
+	void clear();
+
+	/**
+	 * Returns the number of times the ring has gone to the heap (to grow)
+	 * since it was created.
+	 */
+	uint64_t get_allocations() const;
+
+private:
+	struct Slot {
+		T 			value;
+		bool 		present;
+	};
+
+	std::vector<Slot> 	slots;
+	uint32_t 			mask; 			// slots.size() - 1
+	uint32_t 			first_seq;
+	uint32_t 			end_seq;
+	uint32_t 			count;
+	uint64_t 			allocations;
+
+	/*
+	 * Moves the entries into a bigger array of slots.
+	 *
+	 * @param capacity Width of window the new array has to fit.
+	 */
+	void grow(uint32_t capacity);
+};
+
+/*
+ * The implementation has to be in the header, since it is a template.
+ */
+
+template <typename T>
+SequenceRing<T>::SequenceRing() {
+	this->mask 			= 0;
+	this->first_seq 	= 0;
+	this->end_seq 		= 0;
+	this->count 		= 0;
+	this->allocations 	= 0;
+}
+
+template <typename T>
+void SequenceRing<T>::reserve(uint32_t capacity) {
+	if (capacity > this->slots.size()) {
+		this->grow(capacity);
+	}
+}
+
+template <typename T>
+bool SequenceRing<T>::empty() const {
+	return this->count == 0;
+}
+
+template <typename T>
+uint32_t SequenceRing<T>::size() const {
+	return this->count;
+}
+
+template <typename T>
+uint32_t SequenceRing<T>::first() const {
+	return this->first_seq;
+}
+
+template <typename T>
+uint32_t SequenceRing<T>::end() const {
+	return this->end_seq;
+}
+
+template <typename T>
+T *SequenceRing<T>::find(uint32_t seq) {
+	if (seq - this->first_seq >= this->end_seq - this->first_seq) {
+		return NULL;
+	}
+	Slot &slot = this->slots[seq & this->mask];
+	return slot.present ? &slot.value : NULL;
+}
+
+template <typename T>
+bool SequenceRing<T>::fits(uint32_t seq) const {
+	uint32_t width;
+	if (this->count == 0) {
+		width = 1;
+	} else if ((int32_t)(seq - this->first_seq) < 0) {
+		width = this->end_seq - seq;
+	} else if (seq - this->first_seq >= this->end_seq - this->first_seq) {
+		width = seq + 1 - this->first_seq;
+	} else {
+		return true;
+	}
+	return width <= this->slots.size();
+}
+
+template <typename T>
+T &SequenceRing<T>::insert(uint32_t seq) {
+	if (this->count == 0) {
+		this->reserve(1);
+		this->first_seq = seq;
+		this->end_seq 	= seq + 1;
+	} else if ((int32_t)(seq - this->first_seq) < 0) {
+		// Widen the window downwards
+		this->reserve(this->end_seq - seq);
+		this->first_seq = seq;
+	} else if (seq - this->first_seq >= this->end_seq - this->first_seq) {
+		// ... or upwards
+		this->reserve(seq + 1 - this->first_seq);
+		this->end_seq = seq + 1;
+	}
+
+	Slot &slot = this->slots[seq & this->mask];
+	if (!slot.present) {
+		slot.present = true;
+		this->count++;
+	}
+	return slot.value;
+}
+
+template <typename T>
+void SequenceRing<T>::erase(uint32_t seq) {
+	if (this->find(seq) == NULL) {
+		return;
+	}
+	this->slots[seq & this->mask].present = false;
+	this->count--;
+
+	// Narrow the window to the entries left
+	if (this->count == 0) {
+		this->end_seq = this->first_seq;
+		return;
+	}
+	while (!this->slots[this->first_seq & this->mask].present) {
+		this->first_seq++;
+	}
+	while (!this->slots[(this->end_seq - 1) & this->mask].present) {
+		this->end_seq--;
+	}
+}
+
+template <typename T>
+void SequenceRing<T>::clear() {
+	for (uint32_t seq = this->first_seq; seq != this->end_seq; seq++) {
+		this->slots[seq & this->mask].present = false;
+	}
+	this->count 	= 0;
+	this->end_seq 	= this->first_seq;
+}
+
+template <typename T>
+uint64_t SequenceRing<T>::get_allocations() const {
+	return this->allocations;
+}
+
+template <typename T>
+void SequenceRing<T>::grow(uint32_t capacity) {
+	uint32_t size = this->slots.empty() ? 16 : this->slots.size();
+	while (size < capacity) {
+		size *= 2;
+	}
+
+	std::vector<Slot> slots(size); 	// value initialized: nothing present
+	for (uint32_t seq = this->first_seq; seq != this->end_seq; seq++) {
+		Slot &slot = this->slots[seq & this->mask];
+		if (slot.present) {
+			slots[seq & (size - 1)].value 	= std::move(slot.value);
+			slots[seq & (size - 1)].present = true;
+		}
+	}
+
+	this->slots.swap(slots);
+	this->mask = size - 1;
+	this->allocations++;
+}
+
+#endif
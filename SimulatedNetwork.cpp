@@ -0,0 +1,481 @@
+/*
+ * File: SimulatedNetwork.cpp
+ *
+ * In-process simulated network for testing the reliable data transport (RDT)
+ * library.
+ *
+ */
+
+// C++ library includes
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// OS specific includes
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "SimulatedNetwork.h"
+#include "rdt_log.h"
+#include "rdt_time.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the SimulatedNetwork header file.
+ */
+
+SimulatedTransport::SimulatedTransport(SimulatedNetwork *network) {
+	this->network 			= network;
+	this->port 				= 0;
+	this->peer_port 		= 0;
+	this->closed 			= false;
+	this->mtu_discover 		= IP_PMTUDISC_WANT;
+	this->inbox_bytes 		= 0;
+	this->recv_buffer_size 	= DEFAULT_RECV_BUFFER_SIZE;
+	this->link_free 		= 0;
+}
+
+SimulatedTransport::~SimulatedTransport() {
+	if (!this->closed) {
+		this->close();
+	}
+}
+
+uint16_t SimulatedTransport::get_port() {
+	return this->port;
+}
+
+int SimulatedTransport::get_fd() {
+	return -1;
+}
+
+void SimulatedTransport::bind_ephemeral() {
+	if (this->port != 0) {
+		return;
+	}
+
+	SimulatedNetwork *net = this->network;
+	while (net->endpoints.count(net->next_ephemeral_port) > 0) {
+		net->next_ephemeral_port++;
+		if (net->next_ephemeral_port == 0) {
+			net->next_ephemeral_port = SimulatedNetwork::FIRST_EPHEMERAL_PORT;
+		}
+	}
+	this->port = net->next_ephemeral_port++;
+	net->endpoints[this->port] = this;
+}
+
+int SimulatedTransport::bind(const struct sockaddr_in *addr) {
+	uint16_t port = ntohs(addr->sin_port);
+	if (this->port != 0) {
+		errno = EINVAL;
+		return -1;
+	} else if (port == 0) {
+		this->bind_ephemeral();
+		return 0;
+	} else if (this->network->endpoints.count(port) > 0) {
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	this->port = port;
+	this->network->endpoints[port] = this;
+	return 0;
+}
+
+int SimulatedTransport::connect(const struct sockaddr_in *addr) {
+	this->bind_ephemeral();
+	this->peer_port = ntohs(addr->sin_port);
+	return 0;
+}
+
+int SimulatedTransport::send_batch(struct mmsghdr *msgs, int num_msgs) {
+	this->bind_ephemeral();
+
+	for (int i = 0; i < num_msgs; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		uint16_t to_port = this->peer_port;
+		if (hdr->msg_name != NULL) {
+			to_port = ntohs(((struct sockaddr_in*)hdr->msg_name)->sin_port);
+		}
+		if (to_port == 0) {
+			if (i == 0) {
+				errno = EDESTADDRREQ;
+				return -1;
+			}
+			return i;
+		}
+
+		std::vector<char> data;
+		for (size_t j = 0; j < hdr->msg_iovlen; j++) {
+			const char *piece = (const char*)hdr->msg_iov[j].iov_base;
+			data.insert(data.end(), piece, piece + hdr->msg_iov[j].iov_len);
+		}
+		msgs[i].msg_len = data.size();
+		this->network->transmit(this, to_port, data);
+	}
+
+	return num_msgs;
+}
+
+int SimulatedTransport::receive_batch(struct mmsghdr *msgs, int num_msgs) {
+	this->network->deliver_due();
+	if (this->inbox.empty()) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	int num_received = 0;
+	while (num_received < num_msgs && !this->inbox.empty()) {
+		Datagram &datagram = this->inbox.front();
+		struct msghdr *hdr = &msgs[num_received].msg_hdr;
+
+		// Copy as much as fits, as recvmsg would
+		size_t copied = 0;
+		for (size_t j = 0; j < hdr->msg_iovlen && copied < datagram.data.size(); j++) {
+			size_t length = datagram.data.size() - copied;
+			if (length > hdr->msg_iov[j].iov_len) {
+				length = hdr->msg_iov[j].iov_len;
+			}
+			memcpy(hdr->msg_iov[j].iov_base, datagram.data.data() + copied, length);
+			copied += length;
+		}
+		hdr->msg_flags 		= (copied < datagram.data.size()) ? MSG_TRUNC : 0;
+		hdr->msg_controllen = 0;
+		msgs[num_received].msg_len = copied;
+
+		if (hdr->msg_name != NULL && hdr->msg_namelen >= sizeof(struct sockaddr_in)) {
+			struct sockaddr_in *from = (struct sockaddr_in*)hdr->msg_name;
+			memset(from, 0, sizeof(*from));
+			from->sin_family 		= AF_INET;
+			from->sin_port 			= htons(datagram.from_port);
+			from->sin_addr.s_addr 	= htonl(INADDR_LOOPBACK);
+			hdr->msg_namelen 		= sizeof(*from);
+		}
+
+		this->inbox_bytes -= datagram.data.size();
+		this->inbox.pop_front();
+		num_received++;
+	}
+
+	return num_received;
+}
+
+int SimulatedTransport::wait_readable(int timeout_ms) {
+	return this->network->wait(this, timeout_ms);
+}
+
+int SimulatedTransport::set_option(int level, int name, const void *value, socklen_t length) {
+	if (level == SOL_SOCKET && name == SO_RCVBUF && length >= sizeof(int)) {
+		memcpy(&this->recv_buffer_size, value, sizeof(int));
+		return 0;
+	} else if (level == IPPROTO_IP && name == IP_MTU_DISCOVER && length >= sizeof(int)) {
+		memcpy(&this->mtu_discover, value, sizeof(int));
+		return 0;
+	} else if (level == SOL_SOCKET && name == SO_REUSEPORT) {
+		// Ports are never shared
+		return 0;
+	}
+
+	errno = ENOPROTOOPT;
+	return -1;
+}
+
+int SimulatedTransport::get_option(int level, int name, void *value, socklen_t *length) {
+	int result;
+	if (level == SOL_SOCKET && name == SO_RCVBUF) {
+		result = this->recv_buffer_size;
+	} else if (level == IPPROTO_IP && name == IP_MTU && this->peer_port == 0) {
+		errno = ENOTCONN;
+		return -1;
+	} else if (level == IPPROTO_IP && name == IP_MTU) {
+		// The MTU counts the IPv4 and UDP headers
+		int mtu = this->network->conditions.mtu;
+		result = (mtu > 0) ? mtu + 28 : 65535;
+	} else {
+		errno = ENOPROTOOPT;
+		return -1;
+	}
+
+	if (*length < sizeof(int)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(value, &result, sizeof(int));
+	*length = sizeof(int);
+	return 0;
+}
+
+int SimulatedTransport::set_nonblocking(bool) {
+	return 0;
+}
+
+uint32_t SimulatedTransport::random() {
+	return this->network->generator();
+}
+
+int SimulatedTransport::close() {
+	if (this->port != 0) {
+		this->network->endpoints.erase(this->port);
+	}
+	this->inbox.clear();
+	this->inbox_bytes 	= 0;
+	this->closed 		= true;
+	return 0;
+}
+
+SimulatedNetwork::SimulatedNetwork(uint32_t seed) : generator(seed), chance(0.0, 1.0) {
+	this->clock 				= START_TIME_US;
+	this->time_limit 			= 0;
+	this->next_ephemeral_port 	= FIRST_EPHEMERAL_PORT;
+	this->next_order 			= 0;
+	this->current 				= -1;
+	this->num_done 				= 0;
+	memset(&this->conditions, 0, sizeof(this->conditions));
+	memset(&this->stats, 0, sizeof(this->stats));
+	set_clock_source(&this->clock);
+}
+
+SimulatedNetwork::~SimulatedNetwork() {
+	set_clock_source(NULL);
+}
+
+void SimulatedNetwork::set_conditions(const RDTLinkConditions &conditions) {
+	this->conditions = conditions;
+}
+
+void SimulatedNetwork::set_time_limit(uint64_t limit_us) {
+	this->time_limit = (limit_us > 0) ? START_TIME_US + limit_us : 0;
+}
+
+SimulatedTransport *SimulatedNetwork::create_endpoint() {
+	return new SimulatedTransport(this);
+}
+
+uint64_t SimulatedNetwork::get_time() {
+	return this->clock;
+}
+
+RDTLinkStats SimulatedNetwork::get_stats() {
+	return this->stats;
+}
+
+void SimulatedNetwork::transmit(SimulatedTransport *from, uint16_t to_port,
+								std::vector<char> &data) {
+	// The same impairments, in the same order, as lossy_link. Unlike
+	// lossy_link, we know whether the sender lets a datagram over the MTU
+	// be fragmented; it is then lost if any of its fragments is.
+	const RDTLinkConditions &link = this->conditions;
+	int num_fragments = 1;
+	if (link.mtu > 0 && (int)data.size() > link.mtu) {
+		if (from->mtu_discover != IP_PMTUDISC_DONT) {
+			this->stats.too_big++;
+			return;
+		}
+		num_fragments = (data.size() + link.mtu - 1) / link.mtu;
+		this->stats.fragmented++;
+	}
+	bool lost = false;
+	for (int i = 0; i < num_fragments; i++) {
+		lost |= this->chance(this->generator) < link.loss;
+	}
+	if (lost) {
+		this->stats.dropped++;
+		return;
+	}
+
+	// Wait for the link to be free, unless the queue is full
+	uint64_t arrival = this->clock;
+	if (link.rate_kbps > 0) {
+		if (from->link_free < this->clock) {
+			from->link_free = this->clock;
+		}
+		if ((from->link_free - this->clock) * link.rate_kbps / 8000 > (uint64_t)link.queue_bytes) {
+			this->stats.overflowed++;
+			return;
+		}
+		from->link_free += (uint64_t)data.size() * 8000 / link.rate_kbps;
+		arrival 		= from->link_free;
+	}
+
+	arrival += link.delay_us;
+	if (link.jitter_us > 0) {
+		arrival += (uint64_t)(this->chance(this->generator) * link.jitter_us);
+	}
+	if (this->chance(this->generator) < link.reorder) {
+		arrival += link.reorder_us;
+		this->stats.reordered++;
+	}
+
+	InFlight datagram;
+	datagram.arrival 	= arrival;
+	datagram.order 		= this->next_order++;
+	datagram.from_port 	= from->port;
+	datagram.to_port 	= to_port;
+	datagram.data.swap(data);
+	if (!datagram.data.empty() && this->chance(this->generator) < link.corrupt) {
+		size_t bit = (size_t)(this->chance(this->generator) * datagram.data.size() * 8);
+		datagram.data[bit / 8] ^= (char)(1 << (bit % 8));
+		this->stats.corrupted++;
+	}
+	if (this->chance(this->generator) < link.duplicate) {
+		this->in_flight.push(datagram);
+		datagram.order = this->next_order++;
+		this->stats.duplicated++;
+	}
+	this->in_flight.push(datagram);
+}
+
+void SimulatedNetwork::deliver_due() {
+	while (!this->in_flight.empty() && this->in_flight.top().arrival <= this->clock) {
+		const InFlight &datagram = this->in_flight.top();
+
+		// As with UDP, nobody listening, a connected endpoint that isn't
+		// expecting it and a full receive buffer all drop it without a word
+		std::unordered_map<uint16_t, SimulatedTransport*>::iterator it =
+			this->endpoints.find(datagram.to_port);
+		SimulatedTransport *endpoint = (it != this->endpoints.end()) ? it->second : NULL;
+		if (endpoint == NULL
+				|| (endpoint->peer_port != 0 && endpoint->peer_port != datagram.from_port)
+				|| endpoint->inbox_bytes + (int)datagram.data.size() > endpoint->recv_buffer_size) {
+			this->stats.undeliverable++;
+		} else {
+			endpoint->inbox.push_back(SimulatedTransport::Datagram());
+			endpoint->inbox.back().from_port = datagram.from_port;
+			endpoint->inbox.back().data 	 = datagram.data;
+			endpoint->inbox_bytes 			+= datagram.data.size();
+			this->stats.delivered++;
+		}
+		this->in_flight.pop();
+	}
+}
+
+int SimulatedNetwork::wait(SimulatedTransport *endpoint, int timeout_ms) {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->deliver_due();
+	if (!endpoint->inbox.empty() || timeout_ms == 0) {
+		return endpoint->inbox.empty() ? 0 : 1;
+	}
+
+	uint64_t deadline = (timeout_ms < 0) ? NEVER : this->clock + (uint64_t)timeout_ms * 1000;
+	if (this->current < 0) {
+		// Outside of run there is nobody else to take a turn, so just move
+		// the clock on
+		while (endpoint->inbox.empty() && this->clock < deadline) {
+			this->advance_clock(deadline);
+			this->deliver_due();
+		}
+	} else {
+		Task &task 			= this->tasks[this->current];
+		task.state 			= TASK_WAITING;
+		task.waiting_on 	= endpoint;
+		task.deadline 		= deadline;
+		this->switch_tasks(lock);
+	}
+
+	return endpoint->inbox.empty() ? 0 : 1;
+}
+
+void SimulatedNetwork::advance_clock(uint64_t deadline) {
+	uint64_t next = deadline;
+	if (!this->in_flight.empty() && this->in_flight.top().arrival < next) {
+		next = this->in_flight.top().arrival;
+	}
+	for (size_t i = 0; i < this->tasks.size(); i++) {
+		if (this->tasks[i].state == TASK_WAITING && this->tasks[i].deadline < next) {
+			next = this->tasks[i].deadline;
+		}
+	}
+
+	if (next == NEVER) {
+		RDT_LOG(RDT_LOG_ERROR, "SimulatedNetwork: every task is waiting for a "
+								"datagram, and none is on its way\n");
+		exit(EXIT_FAILURE);
+	} else if (this->time_limit != 0 && next > this->time_limit) {
+		RDT_LOG(RDT_LOG_ERROR, "SimulatedNetwork: still running after "
+				<< (this->time_limit - START_TIME_US) / 1000 << " ms of virtual time\n");
+		exit(EXIT_FAILURE);
+	}
+	if (next > this->clock) {
+		this->clock = next;
+	}
+}
+
+int SimulatedNetwork::pick_next_task(int after) {
+	int num_tasks = this->tasks.size();
+	while (this->num_done < this->tasks.size()) {
+		this->deliver_due();
+
+		// Take turns, starting with the one after the task that stopped
+		for (int i = 1; i <= num_tasks; i++) {
+			int index = (after + i) % num_tasks;
+			Task &task = this->tasks[index];
+			if (task.state == TASK_READY || (task.state == TASK_WAITING
+					&& (!task.waiting_on->inbox.empty() || task.deadline <= this->clock))) {
+				return index;
+			}
+		}
+
+		this->advance_clock(NEVER);
+	}
+
+	return -1;
+}
+
+void SimulatedNetwork::switch_tasks(std::unique_lock<std::mutex> &lock) {
+	int index 		= this->current;
+	this->current 	= this->pick_next_task(index);
+	this->turn_changed.notify_all();
+	if (this->tasks[index].state == TASK_DONE) {
+		return;
+	}
+
+	this->turn_changed.wait(lock, [this, index]() { return this->current == index; });
+	this->tasks[index].state = TASK_RUNNING;
+}
+
+void SimulatedNetwork::run_task(int index) {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->turn_changed.wait(lock, [this, index]() { return this->current == index; });
+	this->tasks[index].state = TASK_RUNNING;
+	lock.unlock();
+
+	this->tasks[index].function();
+
+	lock.lock();
+	this->tasks[index].state = TASK_DONE;
+	this->num_done++;
+	this->switch_tasks(lock);
+}
+
+void SimulatedNetwork::run(const std::vector<std::function<void()>> &tasks) {
+	if (tasks.empty()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->tasks.clear();
+	this->tasks.resize(tasks.size());
+	this->num_done = 0;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		this->tasks[i].function 	= tasks[i];
+		this->tasks[i].state 		= TASK_READY;
+		this->tasks[i].waiting_on 	= NULL;
+		this->tasks[i].deadline 	= NEVER;
+		this->tasks[i].thread 		= std::thread(&SimulatedNetwork::run_task, this, (int)i);
+	}
+
+	// The tasks hand the turn to each other until the last one returns
+	this->current = 0;
+	this->turn_changed.notify_all();
+	this->turn_changed.wait(lock, [this]() { return this->num_done == this->tasks.size(); });
+	lock.unlock();
+
+	for (size_t i = 0; i < this->tasks.size(); i++) {
+		this->tasks[i].thread.join();
+	}
+	this->tasks.clear();
+	this->current = -1;
+}
@@ -0,0 +1,347 @@
+/*
+ * File: SimulatedNetwork.h
+ *
+ * Header / API file for an in-process network that RDT sockets can run over
+ * instead of real UDP sockets, for testing the protocol. Datagrams between
+ * its endpoints go through a simulated link with the impairments of
+ * lossy_link (loss, delay, jitter, reordering, duplication, corruption, a
+ * bandwidth limit and an MTU), and time is a virtual clock: the library's
+ * clock (see set_clock_source) reads it for as long as the network exists.
+ *
+ * The clock only moves when every task of run is waiting on its endpoint,
+ * and then jumps straight to the next thing that can happen (a datagram
+ * arriving or a wait timing out). Only one task runs at a time and they take
+ * turns in a fixed order, so a transfer that would take seconds over a real
+ * link takes as long as the protocol's own work, and everything that
+ * happens, down to which datagrams are lost, depends only on the seed.
+ *
+ * Every endpoint is at 127.0.0.1; the port tells them apart.
+ *
+ */
+#ifndef SIMULATED_NETWORK_H
+#define SIMULATED_NETWORK_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "DatagramTransport.h"
+
+class SimulatedNetwork;
+
+/**
+ * The impairments of the simulated link, applied to every datagram (in
+ * either direction) sent after they are set. All zero means a perfect link
+ * with no delay.
+ */
+struct RDTLinkConditions {
+	double 		loss; 			// probability a datagram is dropped
+	uint32_t 	delay_us; 		// fixed one-way delay
+	uint32_t 	jitter_us; 		// extra random delay, up to this much
+	double 		reorder; 		// probability a datagram is held back
+	uint32_t 	reorder_us; 	// how long a reordered datagram is held back
+	double 		duplicate; 		// probability a datagram is sent twice
+	double 		corrupt; 		// probability a bit of a datagram is flipped
+	uint32_t 	rate_kbps; 		// each endpoint's bandwidth in kbit/s (0 for unlimited)
+	int 		queue_bytes; 	// most bytes waiting for the bandwidth limit
+	int 		mtu; 			// largest datagram that gets through whole (0 for any)
+};
+
+/**
+ * What happened to the datagrams sent on a simulated network.
+ */
+struct RDTLinkStats {
+	uint64_t 	delivered;
+	uint64_t 	dropped; 		// lost on the link
+	uint64_t 	overflowed; 	// dropped by the bandwidth limit's queue
+	uint64_t 	duplicated;
+	uint64_t 	reordered;
+	uint64_t 	corrupted;
+	uint64_t 	too_big; 		// dropped for being over the MTU
+	uint64_t 	fragmented; 	// let through over the MTU, in fragments
+	uint64_t 	undeliverable; 	// nobody on the port, or its receive buffer full
+};
+
+/**
+ * An endpoint on a simulated network. Like a UDP socket, it takes datagrams
+ * from anyone until it is connected, and is given a port of its own the
+ * first time it sends if it wasn't bound to one.
+ *
+ * @note It has no file descriptor, so it can't be used with an RDTReactor:
+ * sockets on a simulated network run in blocking mode, each in a task of
+ * SimulatedNetwork::run.
+ */
+class SimulatedTransport : public DatagramTransport {
+public:
+	/**
+	 * Closes the endpoint, unless close already did.
+	 */
+	~SimulatedTransport();
+
+	/**
+	 * Returns the endpoint's port (0 if it doesn't have one yet).
+	 */
+	uint16_t get_port();
+
+	int get_fd();
+	int bind(const struct sockaddr_in *addr);
+	int connect(const struct sockaddr_in *addr);
+	int send_batch(struct mmsghdr *msgs, int num_msgs);
+	int receive_batch(struct mmsghdr *msgs, int num_msgs);
+	int wait_readable(int timeout_ms);
+	int set_option(int level, int name, const void *value, socklen_t length);
+	int get_option(int level, int name, void *value, socklen_t *length);
+	int set_nonblocking(bool enabled);
+	uint32_t random();
+	int close();
+
+private:
+	// Endpoints are created by, and deliver through, their network
+	friend class SimulatedNetwork;
+
+	// The receive buffer's size until SO_RCVBUF changes it (Linux's default)
+	static const int DEFAULT_RECV_BUFFER_SIZE = 212992;
+
+	struct Datagram {
+		uint16_t 			from_port;
+		std::vector<char> 	data;
+	};
+
+	SimulatedNetwork 	*network;
+	uint16_t 			port; 			// 0 until bound
+	uint16_t 			peer_port; 		// 0 unless connected
+	bool 				closed;
+
+	// IP_MTU_DISCOVER: with IP_PMTUDISC_DONT, datagrams over the MTU are
+	// fragmented instead of dropped
+	int 				mtu_discover;
+
+	// Datagrams that arrived and haven't been received yet, and their bytes
+	// (which may add up to at most recv_buffer_size)
+	std::deque<Datagram> inbox;
+	int 				inbox_bytes;
+	int 				recv_buffer_size;
+
+	// When the bandwidth limited link out of this endpoint is free again (us)
+	uint64_t 			link_free;
+
+	SimulatedTransport(SimulatedNetwork *network);
+
+	/*
+	 * Gives the endpoint a free port if it doesn't have one yet.
+	 */
+	void bind_ephemeral();
+};
+
+/**
+ * The network: a link between any two of its endpoints, a virtual clock and
+ * a scheduler for the tasks that use them.
+ *
+ * @note Only one network may exist at a time (it is the library's clock).
+ * Its endpoints, and the sockets using them, must be deleted before it.
+ */
+class SimulatedNetwork {
+public:
+	// What the virtual clock reads when the network is created (us). Not 0,
+	// which the library takes to mean "no time" in places.
+	static const uint64_t START_TIME_US = 1000000;
+
+	/**
+	 * Creates a network with a perfect link and makes its virtual clock the
+	 * library's clock.
+	 *
+	 * @param seed Seed for everything that is left to chance: the link's
+	 * impairments and what transports pick at random (see
+	 * DatagramTransport::random).
+	 */
+	explicit SimulatedNetwork(uint32_t seed);
+
+	/**
+	 * Gives the library back the monotonic clock.
+	 */
+	~SimulatedNetwork();
+
+	SimulatedNetwork(const SimulatedNetwork&) = delete;
+	SimulatedNetwork& operator=(const SimulatedNetwork&) = delete;
+
+	/**
+	 * Sets the impairments of the link.
+	 *
+	 * @param conditions The impairments.
+	 */
+	void set_conditions(const RDTLinkConditions &conditions);
+
+	/**
+	 * Sets how long the tasks of run may take. A scenario that would go on
+	 * past that (e.g. a sender resending to a host that is long gone) is
+	 * reported, and the process exits.
+	 *
+	 * @param limit_us Virtual time from when the network was created (us),
+	 * or 0 for no limit (the default).
+	 */
+	void set_time_limit(uint64_t limit_us);
+
+	/**
+	 * Creates an endpoint, e.g. for a ReliableSocket or RDTListener (which
+	 * then owns it).
+	 *
+	 * @return The new endpoint.
+	 */
+	SimulatedTransport *create_endpoint();
+
+	/**
+	 * Runs each task in a thread of its own until they have all returned,
+	 * one at a time: a task runs until it waits on an endpoint (i.e. would
+	 * block on the network), and then the next one that can go on does.
+	 *
+	 * @note If every task is waiting with no timeout and no datagram is on
+	 * its way, they would wait forever: that is reported and the process
+	 * exits.
+	 *
+	 * @param tasks The tasks.
+	 */
+	void run(const std::vector<std::function<void()>> &tasks);
+
+	/**
+	 * Returns the virtual time (us).
+	 */
+	uint64_t get_time();
+
+	/**
+	 * Returns what happened to the datagrams sent so far.
+	 */
+	RDTLinkStats get_stats();
+
+private:
+	friend class SimulatedTransport;
+
+	// A deadline that never comes
+	static const uint64_t NEVER = UINT64_MAX;
+
+	// First port handed out to endpoints that weren't bound to one
+	static const uint16_t FIRST_EPHEMERAL_PORT = 32768;
+
+	/*
+	 * A datagram on its way across the link.
+	 */
+	struct InFlight {
+		uint64_t 			arrival; 	// us
+		uint64_t 			order; 		// when it was sent, to break ties
+		uint16_t 			from_port;
+		uint16_t 			to_port;
+		std::vector<char> 	data;
+	};
+
+	/*
+	 * Orders datagrams so that the priority queue hands out the earliest
+	 * first.
+	 */
+	struct LaterArrival {
+		bool operator()(const InFlight &a, const InFlight &b) const {
+			if (a.arrival != b.arrival) {
+				return a.arrival > b.arrival;
+			}
+			return a.order > b.order;
+		}
+	};
+
+	enum TaskState { TASK_READY, TASK_RUNNING, TASK_WAITING, TASK_DONE };
+
+	struct Task {
+		std::function<void()> 	function;
+		std::thread 			thread;
+		TaskState 				state;
+		SimulatedTransport 		*waiting_on; 	// while TASK_WAITING
+		uint64_t 				deadline; 		// ... until then at the latest (us)
+	};
+
+	uint64_t 			clock; 			// the virtual time (us)
+	uint64_t 			time_limit; 	// the clock never passes this (us, 0 if no limit)
+	std::mt19937 		generator;
+	std::uniform_real_distribution<double> chance;
+	RDTLinkConditions 	conditions;
+	RDTLinkStats 		stats;
+
+	std::unordered_map<uint16_t, SimulatedTransport*> endpoints; 	// by port
+	uint16_t 			next_ephemeral_port;
+
+	std::priority_queue<InFlight, std::vector<InFlight>, LaterArrival> in_flight;
+	uint64_t 			next_order;
+
+	// The tasks of run, the one that is running (-1 if none), and how many
+	// have returned. Handing over from one task to the next is done under
+	// the mutex; everything else is only touched by the running task.
+	std::vector<Task> 	tasks;
+	int 				current;
+	size_t 				num_done;
+	std::mutex 			mutex;
+	std::condition_variable turn_changed;
+
+	/*
+	 * Puts a datagram on the link, where it may be lost, delayed, etc.
+	 *
+	 * @param from The endpoint sending it.
+	 * @param to_port Where it goes.
+	 * @param data The datagram.
+	 */
+	void transmit(SimulatedTransport *from, uint16_t to_port, std::vector<char> &data);
+
+	/*
+	 * Hands every datagram whose time has come to its endpoint.
+	 */
+	void deliver_due();
+
+	/*
+	 * Waits (see SimulatedTransport::wait_readable) until a datagram is ready
+	 * on the endpoint, or for the given time at most.
+	 *
+	 * @param endpoint The endpoint.
+	 * @param timeout_ms Longest wait in ms (-1 for as long as it takes).
+	 * @return 1 if a datagram is ready, 0 on timeout.
+	 */
+	int wait(SimulatedTransport *endpoint, int timeout_ms);
+
+	/*
+	 * Moves the clock on to the next time something happens: a datagram
+	 * arrives, or a waiting task's deadline comes. Reports that nothing ever
+	 * will, or not before the time limit (and exits) if so.
+	 *
+	 * @param deadline A deadline besides the tasks' (NEVER if none).
+	 */
+	void advance_clock(uint64_t deadline);
+
+	/*
+	 * Returns the next task to run after the given one (moving the clock on
+	 * until one can), or -1 if they have all returned.
+	 *
+	 * @param after Index of the task that just stopped.
+	 */
+	int pick_next_task(int after);
+
+	/*
+	 * Hands the turn from the running task to the next one, and waits for it
+	 * to come back (unless the task is done).
+	 *
+	 * @param lock The lock held on the mutex.
+	 */
+	void switch_tasks(std::unique_lock<std::mutex> &lock);
+
+	/*
+	 * The body of a task's thread: waits for its first turn, runs the task
+	 * and hands the turn on.
+	 *
+	 * @param index Index of the task.
+	 */
+	void run_task(int index);
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * File: TimerWheel.cpp
+ *
+ * Hierarchical timer wheel for the reliable data transport (RDT) library.
+ *
+ */
+
+// C++ library includes
+#include <cstddef>
+
+#include "TimerWheel.h"
+#include "rdt_time.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the TimerWheel header file.
+ */
+
+void init_timer(RDTTimer *timer, void *data) {
+	timer->next 	= NULL;
+	timer->prev 	= NULL;
+	timer->deadline = 0;
+	timer->data 	= data;
+}
+
+/*
+ * List helpers. Every list is circular with a sentinel head, so linking and
+ * unlinking never have to check for the ends.
+ */
+static void list_init(RDTTimer *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static void list_append(RDTTimer *head, RDTTimer *timer) {
+	timer->prev 		= head->prev;
+	timer->next 		= head;
+	head->prev->next 	= timer;
+	head->prev 			= timer;
+}
+
+static void list_unlink(RDTTimer *timer) {
+	timer->prev->next 	= timer->next;
+	timer->next->prev 	= timer->prev;
+	timer->next 		= NULL;
+	timer->prev 		= NULL;
+}
+
+TimerWheel::TimerWheel() {
+	this->current 		= current_msec();
+	this->num_timers 	= 0;
+	for (int level = 0; level < LEVELS; level++) {
+		for (int slot = 0; slot < SLOTS; slot++) {
+			list_init(&this->slots[level][slot]);
+		}
+	}
+	list_init(&this->expired);
+}
+
+bool TimerWheel::is_scheduled(const RDTTimer *timer) {
+	return timer->next != NULL;
+}
+
+void TimerWheel::schedule(RDTTimer *timer, uint32_t deadline) {
+	this->cancel(timer);
+	if (this->num_timers == 0) {
+		// Nothing needed the wheel to keep up with the time until now
+		this->current = current_msec();
+	}
+
+	timer->deadline = deadline;
+	this->insert(timer);
+}
+
+void TimerWheel::cancel(RDTTimer *timer) {
+	if (!is_scheduled(timer)) {
+		return;
+	}
+
+	// Anything still in a slot is due after the current time; anything due
+	// by now is on the expired list
+	if ((int32_t)(timer->deadline - this->current) > 0) {
+		this->num_timers--;
+	}
+	list_unlink(timer);
+}
+
+void TimerWheel::insert(RDTTimer *timer) {
+	if ((int32_t)(timer->deadline - this->current) <= 0) {
+		list_append(&this->expired, timer);
+		return;
+	}
+
+	// The lowest level whose current revolution the deadline falls in. The
+	// top level takes anything further away, in the slot that comes around
+	// last; it gets another look when that slot cascades.
+	int level = 0;
+	while (level < LEVELS - 1 && (timer->deadline >> (SLOT_BITS * (level + 1)))
+			!= (this->current >> (SLOT_BITS * (level + 1)))) {
+		level++;
+	}
+
+	uint32_t slot = timer->deadline >> (SLOT_BITS * level);
+	if (level == LEVELS - 1 && (timer->deadline >> (SLOT_BITS * LEVELS))
+			!= (this->current >> (SLOT_BITS * LEVELS))) {
+		slot = (this->current >> (SLOT_BITS * level)) - 1;
+	}
+
+	list_append(&this->slots[level][slot & (SLOTS - 1)], timer);
+	this->num_timers++;
+}
+
+void TimerWheel::cascade(RDTTimer *head) {
+	while (head->next != head) {
+		RDTTimer *timer = head->next;
+		list_unlink(timer);
+		this->num_timers--;
+		this->insert(timer);
+	}
+}
+
+void TimerWheel::advance(uint32_t now) {
+	while ((int32_t)(now - this->current) > 0) {
+		if (this->num_timers == 0) {
+			this->current = now;
+			break;
+		}
+		this->current++;
+
+		// Every level whose slot just came around cascades, top down, so
+		// that timers coming from higher up can cascade again right away
+		int top = 0;
+		while (top < LEVELS - 1
+				&& (this->current & ((1u << (SLOT_BITS * (top + 1))) - 1)) == 0) {
+			top++;
+		}
+		for (int level = top; level > 0; level--) {
+			uint32_t slot = (this->current >> (SLOT_BITS * level)) & (SLOTS - 1);
+			this->cascade(&this->slots[level][slot]);
+		}
+
+		RDTTimer *head = &this->slots[0][this->current & (SLOTS - 1)];
+		while (head->next != head) {
+			RDTTimer *timer = head->next;
+			list_unlink(timer);
+			this->num_timers--;
+			list_append(&this->expired, timer);
+		}
+	}
+}
+
+RDTTimer *TimerWheel::expire(uint32_t now) {
+	this->advance(now);
+	if (this->expired.next == &this->expired) {
+		return NULL;
+	}
+
+	RDTTimer *timer = this->expired.next;
+	list_unlink(timer);
+	return timer;
+}
+
+int TimerWheel::next_expiry(uint32_t now) {
+	this->advance(now);
+	if (this->expired.next != &this->expired) {
+		return 0;
+	} else if (this->num_timers == 0) {
+		return -1;
+	}
+
+	// Timers on a level are always due before those on the levels above, so
+	// the first occupied slot we find (going up) is the earliest
+	for (int level = 0; level < LEVELS; level++) {
+		uint32_t base = this->current >> (SLOT_BITS * level);
+		for (uint32_t i = 1; i < (uint32_t)SLOTS; i++) {
+			RDTTimer *head = &this->slots[level][(base + i) & (SLOTS - 1)];
+			if (head->next != head) {
+				return ((base + i) << (SLOT_BITS * level)) - this->current;
+			}
+		}
+	}
+
+	return -1;
+}
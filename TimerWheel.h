@@ -0,0 +1,130 @@
+/*
+ * File: TimerWheel.h
+ *
+ * Header / API file for the hierarchical timer wheel used by the RDT library
+ * to keep track of retransmission (and handshake/close) deadlines for many
+ * connections at once. Scheduling, rescheduling and cancelling a timer are
+ * O(1); expired timers are picked up by polling from the I/O loop, so no
+ * timer needs a syscall.
+ *
+ * The wheel ticks once per millisecond. Level 0 has a slot for each of the
+ * next SLOTS milliseconds; each level above covers SLOTS times the span of
+ * the one below, and its timers move down a level (cascade) when the wheel
+ * reaches their slot.
+ *
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint>
+
+/**
+ * A timer that can be scheduled on a TimerWheel. It is embedded in whatever
+ * it times (the wheel only links timers together, it never allocates).
+ */
+struct RDTTimer {
+	RDTTimer 		*next; 		// NULL while not scheduled
+	RDTTimer 		*prev;
+	uint32_t 		deadline; 	// when it expires (ms, low 32 bits of current_msec)
+	void 			*data; 		// whatever the owner wants to find from it
+};
+
+/**
+ * Initializes a timer that isn't scheduled.
+ *
+ * @param timer The timer.
+ * @param data Pointer to keep in the timer's data field.
+ */
+void init_timer(RDTTimer *timer, void *data);
+
+class TimerWheel {
+public:
+	// Slots per level (as a power of 2) and number of levels: together they
+	// cover 2^(SLOT_BITS * LEVELS) ms (about 4.6 hours)
+	static const int SLOT_BITS 	= 6;
+	static const int SLOTS 		= 1 << SLOT_BITS;
+	static const int LEVELS 	= 4;
+
+	TimerWheel();
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	/**
+	 * Schedules a timer, moving it if it was already scheduled.
+	 *
+	 * @param timer The timer.
+	 * @param deadline When it should expire (ms, low 32 bits of current_msec).
+	 */
+	void schedule(RDTTimer *timer, uint32_t deadline);
+
+	/**
+	 * Unschedules a timer (if it is scheduled).
+	 *
+	 * @param timer The timer.
+	 */
+	void cancel(RDTTimer *timer);
+
+	/**
+	 * Returns true if the timer is scheduled.
+	 *
+	 * @param timer The timer.
+	 */
+	static bool is_scheduled(const RDTTimer *timer);
+
+	/**
+	 * Takes the next timer that has expired by now off the wheel. Call until
+	 * it returns NULL to handle every expired timer.
+	 *
+	 * @param now The current time (ms).
+	 * @return An expired (and now unscheduled) timer, or NULL if none.
+	 */
+	RDTTimer *expire(uint32_t now);
+
+	/**
+	 * Returns how long the I/O loop can wait before calling expire again.
+	 *
+	 * @note This may be earlier than the first deadline (by up to the span
+	 * of a slot on the level that timer is on), never later.
+	 *
+	 * @param now The current time (ms).
+	 * @return Time in ms (0 if a timer already expired), or -1 if there are
+	 * no timers.
+	 */
+	int next_expiry(uint32_t now);
+
+private:
+	// The time the wheel has been advanced to
+	uint32_t 	current;
+	int 		num_timers;
+
+	// Each slot is a circular list with a sentinel head
+	RDTTimer 	slots[LEVELS][SLOTS];
+
+	// Timers that are due, waiting to be handed out by expire
+	RDTTimer 	expired;
+
+	/*
+	 * Puts a timer in the slot (or the expired list) for its deadline.
+	 *
+	 * @param timer The (unlinked) timer.
+	 */
+	void insert(RDTTimer *timer);
+
+	/*
+	 * Moves the wheel forward to now, cascading timers down the levels and
+	 * moving every timer that comes due to the expired list.
+	 *
+	 * @param now The current time (ms).
+	 */
+	void advance(uint32_t now);
+
+	/*
+	 * Re-inserts every timer in a slot, relative to the current time.
+	 *
+	 * @param head The slot's list head.
+	 */
+	void cascade(RDTTimer *head);
+};
+
+#endif
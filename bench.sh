@@ -0,0 +1,125 @@
+#!/bin/bash
+#
+# File: bench.sh
+#
+# Throughput benchmark for the RDT library: transfers files of several sizes
+# from sender to receiver through lossy_link, under a matrix of link
+# conditions, and reports the completion time (including the close), the
+# throughput (the sender's goodput, from the connection being established to
+# the start of the close) and retransmission overhead of each transfer. Then
+# it runs batches of transfers over the simulated network (see simulate.cpp)
+# in setups the sender and receiver don't use, such as accepting through a
+# listener with large segments and FEC. Run it with `make bench`.
+#
+# Settings (from the environment):
+#   SIZES       file sizes in bytes (space separated)
+#   CONDITIONS  "name=lossy_link options" pairs (separated by ';')
+#   TIMEOUT     seconds a transfer may take before it counts as failed
+#   SIMULATIONS "name=simulate options" pairs (separated by ';')
+#   SENDER_ARGS, RECEIVER_ARGS  extra arguments (e.g. -g)
+#
+
+SIZES=${SIZES:-"65536 1048576 8388608"}
+CONDITIONS=${CONDITIONS:-"clean=;\
+loss1=-l 0.01;\
+loss5=-l 0.05;\
+delay=-d 20 -j 5;\
+reorder=-r 0.1;\
+duplicate=-u 0.05;\
+corrupt=-c 0.01;\
+10mbit=-b 10000 -d 10;\
+mixed=-l 0.02 -d 10 -j 5 -r 0.05 -u 0.01"}
+TIMEOUT=${TIMEOUT:-120}
+SIMULATIONS=${SIMULATIONS:-"listener=-n 200 -L -l 0.02 -d 5 -j 2;\
+jumbo_fec=-n 200 -L -m 9000 -f 4 -l 0.02 -d 5 -j 2 -r 0.05;\
+jumbo_fec1=-n 100 -L -m 9000 -f 1 -l 0.05 -d 5;\
+pmtu=-n 100 -L -m 9000 -p -t 4000 -l 0.01 -d 5"}
+
+cd "$(dirname "$0")"
+for program in sender receiver lossy_link simulate; do
+	if [ ! -x ./$program ]; then
+		echo "bench: ./$program is missing (run make first)" >&2
+		exit 1
+	fi
+done
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+printf "%-10s %10s %9s %14s %8s %9s  %s\n" \
+	condition bytes seconds "throughput" resent overhead result
+
+failures=0
+IFS=';' read -ra condition_list <<< "$CONDITIONS"
+for size in $SIZES; do
+	head -c "$size" /dev/urandom > "$WORK/in"
+
+	for condition in "${condition_list[@]}"; do
+		name=${condition%%=*}
+		options=${condition#*=}
+
+		receiver_port=$((20000 + RANDOM % 20000))
+		proxy_port=$((receiver_port + 1))
+
+		./lossy_link -s 1 $options $proxy_port 127.0.0.1 $receiver_port \
+			2> "$WORK/proxy.log" &
+		proxy=$!
+		timeout "$TIMEOUT" ./receiver $RECEIVER_ARGS $receiver_port \
+			> "$WORK/out" 2> "$WORK/recv.log" &
+		receiver=$!
+		sleep 0.2
+
+		start=$(date +%s.%N)
+		timeout "$TIMEOUT" ./sender $SENDER_ARGS 127.0.0.1 $proxy_port \
+			< "$WORK/in" 2> "$WORK/send.log"
+		wait $receiver
+		end=$(date +%s.%N)
+		kill $proxy 2> /dev/null
+		wait $proxy 2> /dev/null
+
+		# The sender reports goodput, segments sent and retransmissions on one line
+		goodput=$(sed -n 's/^Goodput: \([^ ]*\) Bps.*/\1/p' "$WORK/send.log")
+		sent=$(sed -n 's/.*(\([0-9]*\) segments sent.*/\1/p' "$WORK/send.log")
+		resent=$(sed -n 's/.* \([0-9]*\) retransmissions.*/\1/p' "$WORK/send.log")
+		goodput=${goodput:-0}
+		sent=${sent:-0}
+		resent=${resent:-0}
+
+		if cmp -s "$WORK/in" "$WORK/out"; then
+			result=ok
+		else
+			result=FAILED
+			failures=$((failures + 1))
+		fi
+
+		awk -v name="$name" -v size="$size" -v start="$start" -v end="$end" \
+			-v goodput="$goodput" -v sent="$sent" -v resent="$resent" -v result="$result" 'BEGIN {
+			seconds = end - start
+			overhead = (sent > resent) ? 100 * resent / (sent - resent) : 0
+			printf "%-10s %10d %9.3f %10.2f MB/s %8d %8.1f%%  %s\n",
+				name, size, seconds, goodput / 1e6, resent, overhead, result
+		}'
+	done
+done
+
+echo
+printf "%-10s  %s\n" simulation result
+IFS=';' read -ra simulation_list <<< "$SIMULATIONS"
+for simulation in "${simulation_list[@]}"; do
+	name=${simulation%%=*}
+	options=${simulation#*=}
+
+	# The last line sums up the batch
+	if ./simulate $options 2> "$WORK/simulate.log"; then
+		result=$(tail -n 1 "$WORK/simulate.log")
+	else
+		result="FAILED: $(tail -n 1 "$WORK/simulate.log")"
+		failures=$((failures + 1))
+	fi
+	printf "%-10s  %s\n" "$name" "$result"
+done
+
+if [ $failures -gt 0 ]; then
+	echo "bench: $failures transfer(s) failed" >&2
+	exit 1
+fi
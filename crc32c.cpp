@@ -0,0 +1,141 @@
+/*
+ * File: crc32c.cpp
+ *
+ * CRC32C (Castagnoli) checksum for the RDT library.
+ *
+ */
+
+// C++ library includes
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+#include "crc32c.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the crc32c header file.
+ */
+
+// The Castagnoli polynomial, bit-reversed
+static const uint32_t CRC32C_POLYNOMIAL = 0x82f63b78;
+
+/*
+ * A CRC32C implementation: extends the (non-inverted) CRC over the data.
+ */
+typedef uint32_t (*Crc32cFunction)(uint32_t crc, const uint8_t *data, size_t length);
+
+/*
+ * Lookup tables for slice-by-8: table[0] is the classic byte-at-a-time
+ * table, and table[k][b] is the CRC of byte b followed by k zero bytes, so
+ * eight bytes can be folded in with eight independent lookups.
+ */
+static uint32_t table[8][256];
+
+/*
+ * Fills in the slice-by-8 tables.
+ */
+static bool make_tables() {
+	for (int b = 0; b < 256; b++) {
+		uint32_t crc = b;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+		}
+		table[0][b] = crc;
+	}
+	for (int b = 0; b < 256; b++) {
+		for (int k = 1; k < 8; k++) {
+			table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+		}
+	}
+	return true;
+}
+
+static const bool tables_ready = make_tables();
+
+/*
+ * Portable implementation: eight bytes per step with slice-by-8.
+ */
+static uint32_t crc32c_portable(uint32_t crc, const uint8_t *data, size_t length) {
+	while (length >= 8) {
+		// Assembled byte by byte so it's the same on any byte order
+		uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8
+							  | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff]
+			  ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+			  ^ table[3][data[4]] ^ table[2][data[5]]
+			  ^ table[1][data[6]] ^ table[0][data[7]];
+		data 	+= 8;
+		length 	-= 8;
+	}
+
+	while (length > 0) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *data) & 0xff];
+		data++;
+		length--;
+	}
+	return crc;
+}
+
+#ifdef CRC32C_X86
+/*
+ * Hardware implementation, with the SSE4.2 CRC32 instruction. Compiled for
+ * SSE4.2 whatever the rest of the program is compiled for, so it must only
+ * be called if the CPU has it.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length) {
+#ifdef __x86_64__
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		crc 	= (uint32_t)_mm_crc32_u64(crc, word);
+		data 	+= 8;
+		length 	-= 8;
+	}
+#endif
+	while (length >= 4) {
+		uint32_t word;
+		memcpy(&word, data, sizeof(word));
+		crc 	= _mm_crc32_u32(crc, word);
+		data 	+= 4;
+		length 	-= 4;
+	}
+	while (length > 0) {
+		crc = _mm_crc32_u8(crc, *data);
+		data++;
+		length--;
+	}
+	return crc;
+}
+#endif
+
+/*
+ * Picks the fastest implementation this CPU can run.
+ */
+static Crc32cFunction pick_implementation() {
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		return crc32c_sse42;
+	}
+#endif
+	return crc32c_portable;
+}
+
+static const Crc32cFunction implementation = pick_implementation();
+
+uint32_t crc32c(const void *data, size_t length) {
+	return crc32c_extend(0, data, length);
+}
+
+uint32_t crc32c_extend(uint32_t crc, const void *data, size_t length) {
+	return ~implementation(~crc, (const uint8_t*)data, length);
+}
+
+bool crc32c_is_accelerated() {
+	return implementation != crc32c_portable;
+}
@@ -0,0 +1,46 @@
+/*
+ * File: crc32c.h
+ *
+ * Header / API file for the CRC32C (Castagnoli) checksum used by the RDT
+ * library to detect corrupted segments.
+ *
+ * On x86 processors with SSE4.2 it uses the CRC32 instruction, which
+ * checksums 8 bytes per instruction; elsewhere it falls back to slice-by-8
+ * table lookups. Which one is picked once, when the program starts.
+ *
+ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Computes the CRC32C of some data.
+ *
+ * @param data The data.
+ * @param length Number of bytes.
+ * @return The checksum.
+ */
+uint32_t crc32c(const void *data, size_t length);
+
+/**
+ * Extends a CRC32C to cover more data, e.g. the pieces of a scattered
+ * buffer one at a time: crc32c_extend(crc32c(a, n), b, m) is the CRC32C of
+ * the n bytes at a followed by the m bytes at b.
+ *
+ * @param crc The CRC32C of the data so far (0 for none).
+ * @param data The data that follows.
+ * @param length Number of bytes.
+ * @return The checksum of everything.
+ */
+uint32_t crc32c_extend(uint32_t crc, const void *data, size_t length);
+
+/**
+ * Tells whether the CRC32C is computed with the CPU's CRC32 instruction.
+ *
+ * @return true if so, false if with the portable fallback.
+ */
+bool crc32c_is_accelerated();
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * File: lossy_link.cpp
+ *
+ * UDP proxy that emulates a bad network link between a sender and a
+ * receiver: it can drop, delay, jitter, reorder, duplicate and corrupt
+ * datagrams, limit the bandwidth (with a drop-tail queue), and drop
+ * datagrams that are too big for the link's MTU. Point the sender at the
+ * proxy's port and the proxy at the receiver; the same impairments are
+ * applied in both directions.
+ *
+ * Only one sender at a time is supported: replies from the receiver go to
+ * whoever sent to the proxy last.
+ */
+
+// C++ standard libraries
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// OS specific includes
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using std::cerr;
+
+// Largest datagram we forward
+static const int MAX_DATAGRAM_SIZE = 65536;
+
+/*
+ * A datagram waiting for its departure time.
+ */
+struct Packet {
+	int64_t 			departure; 	// when it leaves the proxy (us)
+	uint64_t 			order; 		// arrival order, to break ties
+	bool 				to_server; 	// direction
+	std::vector<char> 	data;
+};
+
+/*
+ * Orders packets so that the priority queue hands out the earliest first.
+ */
+struct LaterDeparture {
+	bool operator()(const Packet &a, const Packet &b) const {
+		if (a.departure != b.departure) {
+			return a.departure > b.departure;
+		}
+		return a.order > b.order;
+	}
+};
+
+/*
+ * The impairments, from the command line.
+ */
+struct LinkConfig {
+	double 		loss; 			// probability a datagram is dropped
+	int 		delay_ms; 		// fixed one-way delay
+	int 		jitter_ms; 		// extra random delay, up to this much
+	double 		reorder; 		// probability a datagram is held back
+	int 		reorder_ms; 	// how long a reordered datagram is held back
+	double 		duplicate; 		// probability a datagram is sent twice
+	double 		corrupt; 		// probability a bit of a datagram is flipped
+	int 		rate_kbps; 		// bandwidth in kbit/s (0 for unlimited)
+	int 		queue_bytes; 	// most bytes waiting for the bandwidth limit
+	int 		mtu; 			// largest datagram that gets through (0 for any)
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+	stop_requested = 1;
+}
+
+/*
+ * Returns the current time in microseconds (monotonic).
+ */
+static int64_t now_usec() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage(const char *name) {
+	cerr << "Usage: " << name << " [options] <listen port> <receiver host> <receiver port>\n";
+	cerr << "  -l P   drop datagrams with probability P\n";
+	cerr << "  -d MS  delay datagrams by MS milliseconds\n";
+	cerr << "  -j MS  add up to MS milliseconds of random delay (jitter)\n";
+	cerr << "  -r P   hold datagrams back with probability P, so later ones overtake them\n";
+	cerr << "  -o MS  how long reordered datagrams are held back (default 5)\n";
+	cerr << "  -u P   duplicate datagrams with probability P\n";
+	cerr << "  -c P   flip a random bit in datagrams with probability P\n";
+	cerr << "  -b K   limit the bandwidth to K kbit/s in each direction\n";
+	cerr << "  -q B   queue at most B bytes for the bandwidth limit (default 65536)\n";
+	cerr << "  -t B   drop datagrams longer than B bytes (the path MTU)\n";
+	cerr << "  -s N   seed for the random number generator\n";
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	LinkConfig config;
+	memset(&config, 0, sizeof(config));
+	config.reorder_ms 	= 5;
+	config.queue_bytes 	= 65536;
+	unsigned seed 		= std::random_device()();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "l:d:j:r:o:u:c:b:q:t:s:")) != -1) {
+		switch (opt) {
+		case 'l': config.loss 			= atof(optarg); break;
+		case 'd': config.delay_ms 		= atoi(optarg); break;
+		case 'j': config.jitter_ms 		= atoi(optarg); break;
+		case 'r': config.reorder 		= atof(optarg); break;
+		case 'o': config.reorder_ms 	= atoi(optarg); break;
+		case 'u': config.duplicate 		= atof(optarg); break;
+		case 'c': config.corrupt 		= atof(optarg); break;
+		case 'b': config.rate_kbps 		= atoi(optarg); break;
+		case 'q': config.queue_bytes 	= atoi(optarg); break;
+		case 't': config.mtu 			= atoi(optarg); break;
+		case 's': seed 					= strtoul(optarg, NULL, 10); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (argc - optind != 3) {
+		usage(argv[0]);
+	}
+
+	// Find the receiver
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family 	= AF_INET;
+	hints.ai_socktype 	= SOCK_DGRAM;
+	struct addrinfo *result;
+	int error = getaddrinfo(argv[optind + 1], argv[optind + 2], &hints, &result);
+	if (error != 0) {
+		cerr << "getaddrinfo: " << gai_strerror(error) << "\n";
+		exit(EXIT_FAILURE);
+	}
+	struct sockaddr_in server_addr;
+	memcpy(&server_addr, result->ai_addr, sizeof(server_addr));
+	freeaddrinfo(result);
+
+	int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock_fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family 		= AF_INET;
+	addr.sin_port 			= htons(atoi(argv[optind]));
+	addr.sin_addr.s_addr 	= INADDR_ANY;
+	if (bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGINT, request_stop);
+	signal(SIGTERM, request_stop);
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+	struct sockaddr_in client_addr;
+	bool have_client = false;
+
+	std::priority_queue<Packet, std::vector<Packet>, LaterDeparture> pending;
+	uint64_t next_order = 0;
+
+	// Per direction (0: to the receiver, 1: to the sender): when the
+	// bandwidth limited link is free again
+	int64_t link_free[2] = { 0, 0 };
+
+	uint64_t forwarded = 0, dropped = 0, overflowed = 0, duplicated = 0, reordered = 0;
+	uint64_t corrupted = 0, too_big = 0;
+
+	std::vector<char> buffer(MAX_DATAGRAM_SIZE);
+	while (!stop_requested) {
+		// Sleep until the next datagram is due, or one arrives
+		int timeout = -1;
+		if (!pending.empty()) {
+			int64_t wait = pending.top().departure - now_usec();
+			timeout = (wait > 0) ? (int)((wait + 999) / 1000) : 0;
+		}
+
+		struct pollfd pfd;
+		pfd.fd 		= sock_fd;
+		pfd.events 	= POLLIN;
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+
+		// Take in everything that has arrived
+		while (pfd.revents & POLLIN) {
+			struct sockaddr_in from;
+			socklen_t from_len = sizeof(from);
+			int length = recvfrom(sock_fd, buffer.data(), buffer.size(), MSG_DONTWAIT,
+								  (struct sockaddr*)&from, &from_len);
+			if (length < 0) {
+				break;
+			}
+
+			bool to_server = from.sin_addr.s_addr != server_addr.sin_addr.s_addr
+							 || from.sin_port != server_addr.sin_port;
+			if (to_server) {
+				client_addr = from;
+				have_client = true;
+			} else if (!have_client) {
+				continue;
+			}
+
+			if (config.mtu > 0 && length > config.mtu) {
+				too_big++;
+				continue;
+			} else if (chance(rng) < config.loss) {
+				dropped++;
+				continue;
+			}
+
+			// Wait for the link to be free, unless the queue is full
+			int64_t now 		= now_usec();
+			int64_t departure 	= now;
+			if (config.rate_kbps > 0) {
+				int64_t &free_at = link_free[to_server ? 0 : 1];
+				if (free_at < now) {
+					free_at = now;
+				}
+				if ((free_at - now) * config.rate_kbps / 8000 > config.queue_bytes) {
+					overflowed++;
+					continue;
+				}
+				free_at 	+= (int64_t)length * 8000 / config.rate_kbps;
+				departure 	= free_at;
+			}
+
+			departure += config.delay_ms * 1000;
+			if (config.jitter_ms > 0) {
+				departure += (int64_t)(chance(rng) * config.jitter_ms * 1000);
+			}
+			if (chance(rng) < config.reorder) {
+				departure += config.reorder_ms * 1000;
+				reordered++;
+			}
+
+			Packet packet;
+			packet.departure 	= departure;
+			packet.order 		= next_order++;
+			packet.to_server 	= to_server;
+			packet.data.assign(buffer.begin(), buffer.begin() + length);
+			if (length > 0 && chance(rng) < config.corrupt) {
+				int bit = (int)(chance(rng) * length * 8);
+				packet.data[bit / 8] ^= (char)(1 << (bit % 8));
+				corrupted++;
+			}
+			if (chance(rng) < config.duplicate) {
+				pending.push(packet);
+				packet.order = next_order++;
+				duplicated++;
+			}
+			pending.push(packet);
+		}
+
+		// Send everything that is due
+		int64_t now = now_usec();
+		while (!pending.empty() && pending.top().departure <= now) {
+			const Packet &packet = pending.top();
+			const struct sockaddr_in *to = packet.to_server ? &server_addr : &client_addr;
+			if (sendto(sock_fd, packet.data.data(), packet.data.size(), 0,
+					   (const struct sockaddr*)to, sizeof(*to)) < 0 && errno != ECONNREFUSED) {
+				perror("sendto");
+			}
+			forwarded++;
+			pending.pop();
+		}
+	}
+
+	cerr << "lossy_link: forwarded " << forwarded << ", dropped " << dropped
+			<< " (+" << overflowed << " queue overflows), duplicated " << duplicated
+			<< ", reordered " << reordered << ", corrupted " << corrupted 
+			<< ", too big " << too_big << "\n";
+	close(sock_fd);
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * File: rdt_log.cpp
+ *
+ * Leveled diagnostics for the RDT library.
+ *
+ */
+
+// C++ library includes
+#include <cstdlib>
+#include <cstring>
+
+// OS specific includes
+#include <strings.h>
+
+#include "rdt_log.h"
+
+/*
+ * NOTE: Function header comments shouldn't go in this file: they should be put
+ * in the rdt_log header file.
+ */
+
+/*
+ * Returns the level named by the RDT_LOG environment variable (a level name
+ * such as "debug", or its number), or RDT_LOG_INFO if it isn't set.
+ */
+static int level_from_environment() {
+	const char *names[] = { "none", "error", "warn", "info", "debug", "trace" };
+	const char *value = getenv("RDT_LOG");
+	if (value == NULL || *value == '\0') {
+		return RDT_LOG_INFO;
+	}
+
+	for (int level = RDT_LOG_NONE; level <= RDT_LOG_TRACE; level++) {
+		if (strcasecmp(value, names[level]) == 0) {
+			return level;
+		}
+	}
+	return atoi(value);
+}
+
+static int log_level = level_from_environment();
+
+void set_log_level(int level) {
+	log_level = level;
+}
+
+int get_log_level() {
+	return log_level;
+}
@@ -0,0 +1,64 @@
+/*
+ * File: rdt_log.h
+ *
+ * Header / API file for the leveled diagnostics of the RDT library.
+ *
+ * Every message has a level. Messages above RDT_LOG_MAX_LEVEL (set when
+ * building, e.g. `make LOG_LEVEL=TRACE`) are compiled out entirely, so the
+ * per-segment tracing costs nothing in a normal build. The messages that are
+ * compiled in can be filtered further at run time with set_log_level or the
+ * RDT_LOG environment variable (e.g. RDT_LOG=debug).
+ *
+ */
+#ifndef RDT_LOG_H
+#define RDT_LOG_H
+
+#include <iostream>
+#include <sstream>
+
+// Log levels, from the most to the least important
+#define RDT_LOG_NONE 	0 	// nothing at all
+#define RDT_LOG_ERROR 	1 	// misuse of the API, unrecoverable trouble
+#define RDT_LOG_WARN 	2 	// calls that fail, connections that give up
+#define RDT_LOG_INFO 	3 	// handshake and close
+#define RDT_LOG_DEBUG 	4 	// timeouts, retransmissions, odd segments
+#define RDT_LOG_TRACE 	5 	// every segment sent and received
+
+// The most detailed level that is compiled in
+#ifndef RDT_LOG_MAX_LEVEL
+#define RDT_LOG_MAX_LEVEL RDT_LOG_INFO
+#endif
+
+/**
+ * Sets the most detailed level that is printed (only levels up to
+ * RDT_LOG_MAX_LEVEL can be printed at all). Defaults to RDT_LOG_INFO, or the
+ * level named by the RDT_LOG environment variable.
+ *
+ * @param level One of the RDT_LOG_* levels.
+ */
+void set_log_level(int level);
+
+/**
+ * Returns the most detailed level that is printed.
+ */
+int get_log_level();
+
+/**
+ * Prints a message if its level is enabled. The message is everything that
+ * would follow `std::cerr <<`, e.g.
+ *
+ *     RDT_LOG(RDT_LOG_TRACE, "Sending Sequence Number: #" << seq << ".\n");
+ *
+ * It is only evaluated when it is printed, and it goes out in one write so
+ * that messages from different threads don't interleave.
+ */
+#define RDT_LOG(level, message) 											\
+	do { 																	\
+		if ((level) <= RDT_LOG_MAX_LEVEL && (level) <= get_log_level()) { 	\
+			std::ostringstream rdt_log_line; 								\
+			rdt_log_line << message; 										\
+			std::cerr << rdt_log_line.str(); 								\
+		} 																	\
+	} while (0)
+
+#endif
@@ -3,26 +3,53 @@
  *
  * Header / API file for timing component of RDT library.
  *
- * DO NOT MODIFY THIS FILE!
  */
+#ifndef RDT_TIME_H
+#define RDT_TIME_H
+
+#include <stdint.h>
 #include <sys/time.h>
 
 
+/*
+ * Get the current time (in microseconds) from a monotonic clock.
+ *
+ * @note The time is relative to an arbitrary point (e.g. boot), so it is only
+ * good for measuring intervals, but it never jumps when the system clock is
+ * set.
+ *
+ * @return The number of microseconds since that point.
+ */
+uint64_t current_usec();
+
 /*
  * Get the current time (in milliseconds).
  *
- * @note The current time is given relative to the start of the UNIX epoch.
+ * @note This is current_usec in milliseconds, so the same monotonic clock.
+ * The timer wheel and the statistics only keep the low 32 bits, which wrap
+ * around every 49.7 days; they only ever compare times that are close
+ * together, so that does no harm.
  *
- * @return The number of milliseconds since the UNIX epoch.
+ * @return The number of milliseconds since an arbitrary point.
  */
-int current_msec();
+uint64_t current_msec();
+
+/*
+ * Makes current_usec (and current_msec) read the given time instead of the
+ * monotonic clock, e.g. the virtual clock of a simulated network.
+ *
+ * @note Only call this while no other thread is using the library.
+ *
+ * @param clock The time to use (in microseconds), or NULL to go back to the
+ * 		monotonic clock.
+ */
+void set_clock_source(const uint64_t *clock);
 
 /*
  * Creates a timeval struct that represents the given number of milliseconds.
  *
- * @note You likely won't need to ever call this function directly in the code
- * you write. It is used by the set_timeout_val function in the ReliableSocket
- * starter code, a function you shouldn't need to modify.
+ * @note The library itself no longer uses this: its timeouts are kept on a
+ * timer wheel (see TimerWheel.h).
  *
  * @param millis The number of milliseconds to convert.
  * @param out_timeval Pointer to timeval that will be filled in based on
@@ -41,3 +68,5 @@ void msec_to_timeval(int millis, struct timeval *out_timeval);
  * @return Number of milliseconds (as specified by t)
  */
 int timeval_to_msec(struct timeval *t);
+
+#endif
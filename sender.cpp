@@ -1,17 +1,18 @@
 /*
  * File: sender.cpp
  *
- * Simple program that sends data on standard input to a remote host using the
- * RDT library.
- * 
- * You should NOT modify this file.
+ * Simple program that sends data on standard input (or from a file) to a
+ * remote host using the RDT library.
  */
 
 // C++ standard libraries
 #include <string>
 #include <chrono>
 #include <iostream>
-#include <array>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 // RDT library
 #include "ReliableSocket.h"
@@ -19,33 +20,68 @@
 using std::cerr;
 
 int main(int argc, char** argv) {	
-	if (argc != 3) {
-		cerr << "Usage: " << argv[0] << " <remote host> <remote port>\n";
+	bool offload = false;
+	bool probe = false;
+	int segment_size = ReliableSocket::DEFAULT_SEG_SIZE;
+	int fec_block_size = 0;
+	const char *input_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:gi:m:p")) != -1) {
+		if (opt == 'f') {
+			fec_block_size = atoi(optarg);
+		} else if (opt == 'g') {
+			offload = true;
+		} else if (opt == 'i') {
+			input_path = optarg;
+		} else if (opt == 'm') {
+			segment_size = atoi(optarg);
+		} else if (opt == 'p') {
+			probe = true;
+		} else {
+			argc = 0; // print the usage message
+		}
+	}
+
+	if (argc - optind != 2) {
+		cerr << "Usage: " << argv[0] << " [-f n] [-g] [-i file] [-m bytes] [-p] <remote host> <remote port>\n";
+		cerr << "  -f n      send an FEC repair segment after every n data segments\n";
+		cerr << "  -g        use UDP GSO/GRO offload if available\n";
+		cerr << "  -i file   send file instead of standard input\n";
+		cerr << "  -m bytes  largest segment size to agree on (default " 
+				<< ReliableSocket::DEFAULT_SEG_SIZE << ")\n";
+		cerr << "  -p        probe the path MTU for the largest segment that gets through\n";
 		exit(1);
 	}
 
-	int remote_port_num = std::stoi(argv[2]);
+	int remote_port_num = std::stoi(argv[optind + 1]);
+
+	int input_fd = STDIN_FILENO;
+	if (input_path != NULL) {
+		input_fd = open(input_path, O_RDONLY);
+		if (input_fd < 0) {
+			perror(input_path);
+			exit(1);
+		}
+	}
 
 	// Create a reliable connection and connect to the specified remote host
 	ReliableSocket socket;
-	socket.connect_to_remote(argv[1], remote_port_num);
-
-	// Create a char array and fill it with 0's
-	std::array<char, ReliableSocket::MAX_DATA_SIZE> buff;
-	buff.fill(0);
+	if (offload && !socket.set_offload_enabled(true)) {
+		cerr << "sender: offload not supported, continuing without it\n";
+	}
+	socket.set_max_segment_size(segment_size);
+	socket.set_pmtu_probing(probe);
+	socket.set_fec_block_size(fec_block_size);
+	socket.connect_to_remote(argv[optind], remote_port_num);
 
 	auto start_time = std::chrono::system_clock::now();
 
-	// Use stdin as the source for the data we will be sending
-	int total_bytes = 0;
-	int num_bytes_read = 0;
-	while ((num_bytes_read = fread(buff.data(), 
-									sizeof(char), 
-									ReliableSocket::MAX_DATA_SIZE, 
-									stdin))) {
-		total_bytes += num_bytes_read;
-		socket.send_data(buff.data(), num_bytes_read);
-		cerr << "sender: sent " << num_bytes_read << " bytes of app data\n";
+	// A file (or stdin redirected from one) is sent straight out of memory
+	// mapped pages; a pipe is read in large chunks
+	int64_t total_bytes = socket.send_file(input_fd);
+	if (total_bytes < 0) {
+		perror("sender: send_file");
+		exit(1);
 	}
 
 	auto end_time = std::chrono::system_clock::now();
@@ -58,7 +94,25 @@ int main(int argc, char** argv) {
 			<< elapsed_seconds.count() << " seconds "
 			<< "(" << total_bytes / elapsed_seconds.count() << " Bps)\n";
 
-	cerr << "Estimated RTT:  " << socket.get_estimated_rtt() << " ms\n";
+	cerr << "Estimated RTT:  " << socket.get_estimated_rtt_us() / 1000.0 << " ms\n";
+	cerr << "Segment size:   " << socket.get_segment_size() << " bytes\n";
+
+	RDTStats stats = socket.get_stats();
+	cerr << "Goodput: " << stats.goodput << " Bps ("
+			<< stats.segments_sent << " segments sent, "
+			<< stats.retransmissions << " retransmissions ("
+			<< stats.fast_retransmits << " fast), "
+			<< stats.timeouts << " timeouts, "
+			<< stats.duplicate_acks << " duplicate ACKs, "
+			<< stats.fec_segments_sent << " FEC)\n";
+
+	RDTIOStats io_stats = socket.get_io_stats();
+	cerr << "Packets per syscall: " 
+			<< io_stats.packets_sent / (double)std::max<uint64_t>(io_stats.send_calls, 1)
+			<< " sent, "
+			<< io_stats.packets_received / (double)std::max<uint64_t>(io_stats.recv_calls, 1)
+			<< " received\n";
+	cerr << "Heap allocations (buffers and queues): " << io_stats.heap_allocations << "\n";
 
 	return 0;
 }
@@ -0,0 +1,276 @@
+/*
+ * File: simulate.cpp
+ *
+ * Runs many transfers between a sender and a receiver over a simulated
+ * network (see SimulatedNetwork.h), each with a seed of its own, and checks
+ * that every byte arrives intact. The link takes the same impairments as
+ * lossy_link. Each transfer runs in virtual time, so thousands of them take
+ * seconds, and a transfer that fails can be repeated exactly with its seed.
+ *
+ * Odd seeds start the sender first, so its SYN goes out before the receiver
+ * is listening.
+ *
+ * Both ends take the same socket settings: the segment size (-m), path MTU
+ * probing (-p) and FEC (-f). With -L the receiver accepts its connection
+ * through an RDTListener, which hands it those settings, instead of
+ * accepting it on a socket of its own.
+ *
+ * A transfer that is still going after the time limit (-T) ends the run: the
+ * network reports it, and we say which seed it was.
+ */
+
+// C++ standard libraries
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+// RDT library
+#include "ReliableSocket.h"
+#include "RDTListener.h"
+#include "SimulatedNetwork.h"
+#include "rdt_log.h"
+
+using std::cerr;
+
+// The port the receiver listens on
+static const int RECEIVER_PORT = 5000;
+
+// The seed of the transfer under way, if any, for report_unfinished
+static bool transfer_running = false;
+static uint32_t running_seed;
+
+/*
+ * Says which transfer was under way if the network gave up on it.
+ */
+static void report_unfinished() {
+	if (transfer_running) {
+		cerr << "seed " << running_seed << ": did not finish\n";
+	}
+}
+
+/*
+ * How both ends of a transfer are set up.
+ */
+struct Settings {
+	bool 		use_listener; 	// the receiver accepts through an RDTListener
+	int 		max_seg_size;
+	bool 		pmtu_probing;
+	uint32_t 	fec_block_size;
+};
+
+/*
+ * Applies the settings to one end.
+ */
+template <typename Endpoint>
+static void apply_settings(Endpoint *endpoint, const Settings &settings) {
+	endpoint->set_max_segment_size(settings.max_seg_size);
+	endpoint->set_pmtu_probing(settings.pmtu_probing);
+	endpoint->set_fec_block_size(settings.fec_block_size);
+}
+
+/*
+ * What came of one transfer.
+ */
+struct Outcome {
+	bool 		intact;
+	uint64_t 	virtual_us; 	// from the start until both ends closed
+	RDTStats 	sender_stats;
+	int 		segment_size; 	// the sender's at the end
+	RDTLinkStats link_stats;
+};
+
+/*
+ * Sends length bytes of data made up from the seed from a sender to a
+ * receiver over a network with the given seed and impairments.
+ */
+static Outcome run_transfer(uint32_t seed, const RDTLinkConditions &conditions,
+							int length, const Settings &settings, uint64_t time_limit_us) {
+	SimulatedNetwork network(seed);
+	network.set_conditions(conditions);
+	network.set_time_limit(time_limit_us);
+
+	std::vector<char> data(length);
+	std::mt19937 generator(seed);
+	for (int i = 0; i < length; i++) {
+		data[i] = (char)generator();
+	}
+	std::vector<char> received;
+
+	ReliableSocket *sender 		= new ReliableSocket(network.create_endpoint());
+	ReliableSocket *receiver 	= NULL;
+	RDTListener *listener 		= NULL;
+	apply_settings(sender, settings);
+	if (settings.use_listener) {
+		listener = new RDTListener(network.create_endpoint());
+		apply_settings(listener, settings);
+	} else {
+		receiver = new ReliableSocket(network.create_endpoint());
+		apply_settings(receiver, settings);
+	}
+
+	std::function<void()> send_task = [&]() {
+		char host[] = "127.0.0.1";
+		sender->connect_to_remote(host, RECEIVER_PORT);
+		sender->send_data(data.data(), length);
+		sender->close_connection();
+	};
+	std::function<void()> receive_task = [&]() {
+		if (listener != NULL) {
+			listener->listen_on(RECEIVER_PORT);
+			receiver = listener->accept_connection();
+		} else {
+			receiver->accept_connection(RECEIVER_PORT);
+		}
+		char buffer[ReliableSocket::MAX_DATA_SIZE];
+		int count;
+		while ((count = receiver->receive_data(buffer)) > 0) {
+			received.insert(received.end(), buffer, buffer + count);
+		}
+		receiver->close_connection();
+	};
+
+	if (seed % 2 == 1) {
+		network.run({ send_task, receive_task });
+	} else {
+		network.run({ receive_task, send_task });
+	}
+
+	Outcome outcome;
+	outcome.intact 			= (received == data);
+	outcome.virtual_us 		= network.get_time() - SimulatedNetwork::START_TIME_US;
+	outcome.sender_stats 	= sender->get_stats();
+	outcome.segment_size 	= sender->get_segment_size();
+	outcome.link_stats 		= network.get_stats();
+
+	delete sender;
+	delete receiver;
+	delete listener;
+	return outcome;
+}
+
+static void usage(const char *name) {
+	cerr << "Usage: " << name << " [options]\n";
+	cerr << "  -n N   run N transfers (default 1000)\n";
+	cerr << "  -s N   seed of the first transfer (default 1); the others count up\n";
+	cerr << "  -B B   bytes per transfer (default 100000)\n";
+	cerr << "  -L     accept the connection through an RDTListener\n";
+	cerr << "  -m B   largest segment either end sends, in bytes (default "
+			<< ReliableSocket::DEFAULT_SEG_SIZE << ")\n";
+	cerr << "  -p     probe the path MTU\n";
+	cerr << "  -f n   send an FEC repair segment after every n data segments\n";
+	cerr << "  -T S   give up on a transfer after S seconds of virtual time (default 600)\n";
+	cerr << "  -v     print every transfer, and the library's messages\n";
+	cerr << " link impairments, as for lossy_link:\n";
+	cerr << "  -l P   drop datagrams with probability P\n";
+	cerr << "  -d MS  delay datagrams by MS milliseconds\n";
+	cerr << "  -j MS  add up to MS milliseconds of random delay (jitter)\n";
+	cerr << "  -r P   hold datagrams back with probability P, so later ones overtake them\n";
+	cerr << "  -o MS  how long reordered datagrams are held back (default 5)\n";
+	cerr << "  -u P   duplicate datagrams with probability P\n";
+	cerr << "  -c P   flip a random bit in datagrams with probability P\n";
+	cerr << "  -b K   limit the bandwidth to K kbit/s in each direction\n";
+	cerr << "  -q B   queue at most B bytes for the bandwidth limit (default 65536)\n";
+	cerr << "  -t B   drop datagrams longer than B bytes (the path MTU)\n";
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	RDTLinkConditions conditions;
+	memset(&conditions, 0, sizeof(conditions));
+	conditions.reorder_us 	= 5000;
+	conditions.queue_bytes 	= 65536;
+
+	int num_transfers 			= 1000;
+	uint32_t first_seed 		= 1;
+	int length 					= 100000;
+	Settings settings;
+	settings.use_listener 		= false;
+	settings.max_seg_size 		= ReliableSocket::DEFAULT_SEG_SIZE;
+	settings.pmtu_probing 		= false;
+	settings.fec_block_size 	= 0;
+	int time_limit 				= 600;
+	bool verbose 				= false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:B:Lm:pf:T:vl:d:j:r:o:u:c:b:q:t:")) != -1) {
+		switch (opt) {
+		case 'n': num_transfers 			= atoi(optarg); break;
+		case 's': first_seed 				= strtoul(optarg, NULL, 10); break;
+		case 'B': length 					= atoi(optarg); break;
+		case 'L': settings.use_listener 	= true; break;
+		case 'm': settings.max_seg_size 	= atoi(optarg); break;
+		case 'p': settings.pmtu_probing 	= true; break;
+		case 'f': settings.fec_block_size 	= atoi(optarg); break;
+		case 'T': time_limit 				= atoi(optarg); break;
+		case 'v': verbose 					= true; break;
+		case 'l': conditions.loss 			= atof(optarg); break;
+		case 'd': conditions.delay_us 		= atoi(optarg) * 1000; break;
+		case 'j': conditions.jitter_us 		= atoi(optarg) * 1000; break;
+		case 'r': conditions.reorder 		= atof(optarg); break;
+		case 'o': conditions.reorder_us 	= atoi(optarg) * 1000; break;
+		case 'u': conditions.duplicate 		= atof(optarg); break;
+		case 'c': conditions.corrupt 		= atof(optarg); break;
+		case 'b': conditions.rate_kbps 		= atoi(optarg); break;
+		case 'q': conditions.queue_bytes 	= atoi(optarg); break;
+		case 't': conditions.mtu 			= atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || num_transfers < 1 || length < 0
+			|| settings.max_seg_size < ReliableSocket::MIN_SEG_SIZE
+			|| settings.max_seg_size > ReliableSocket::MAX_SEG_SIZE) {
+		usage(argv[0]);
+	}
+	if (!verbose) {
+		set_log_level(RDT_LOG_ERROR);
+	}
+	atexit(report_unfinished);
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	int num_failed = 0;
+	uint64_t total_virtual_us = 0;
+	uint64_t total_retransmissions = 0;
+	for (int i = 0; i < num_transfers; i++) {
+		uint32_t seed 		= first_seed + i;
+		running_seed 		= seed;
+		transfer_running 	= true;
+		Outcome outcome = run_transfer(seed, conditions, length, settings,
+									   (uint64_t)time_limit * 1000000);
+		transfer_running 	= false;
+		total_virtual_us 		+= outcome.virtual_us;
+		total_retransmissions 	+= outcome.sender_stats.retransmissions;
+
+		if (!outcome.intact) {
+			num_failed++;
+		}
+		if (verbose || !outcome.intact) {
+			cerr << "seed " << seed << ": " << (outcome.intact ? "ok" : "FAILED")
+					<< ", " << outcome.virtual_us / 1000.0 << " ms, "
+					<< outcome.sender_stats.segments_sent << " segments sent, "
+					<< outcome.sender_stats.retransmissions << " retransmissions ("
+					<< outcome.sender_stats.timeouts << " timeouts), "
+					<< outcome.segment_size << "-byte segments; link: "
+					<< outcome.link_stats.delivered << " delivered, "
+					<< outcome.link_stats.dropped << " dropped, "
+					<< outcome.link_stats.reordered << " reordered, "
+					<< outcome.link_stats.duplicated << " duplicated, "
+					<< outcome.link_stats.corrupted << " corrupted, "
+					<< outcome.link_stats.fragmented << " fragmented, "
+					<< outcome.link_stats.undeliverable << " undeliverable\n";
+		}
+	}
+
+	std::chrono::duration<double> elapsed_seconds = std::chrono::steady_clock::now() - start_time;
+	cerr << num_transfers - num_failed << " of " << num_transfers << " transfers intact ("
+			<< total_virtual_us / 1e6 << " s of virtual time, "
+			<< total_retransmissions << " retransmissions) in "
+			<< elapsed_seconds.count() << " seconds\n";
+
+	return (num_failed == 0) ? 0 : 1;
+}